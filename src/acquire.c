@@ -0,0 +1,317 @@
+//
+// Power Monitor Sample Acquisition
+//
+// © Copyright 2026 Glider bv
+//
+// This file is subject to the terms and conditions of the GNU General Public
+// License, version 2.
+//
+
+#include <inttypes.h>
+#include <string.h>
+#include <twi.h>
+
+#include "acquire.h"
+#include "alarm.h"
+#include "capture.h"
+#include "ina219.h"
+#include "print.h"
+#include "task.h"
+#include "util.h"
+
+/*
+ * I2C bits per channel: a register pointer write (START, address, pointer,
+ * STOP) and a 2-byte read (START, address, 2 data bytes, STOP), for both the
+ * shunt and the bus voltage register, with 9 bits per byte including ACK
+ */
+#define ACQUIRE_CH_BITS		(2 * ((9 * 2 + 2) + (9 * 3 + 2)))
+#define ACQUIRE_CH_MARGIN_US	10		/* Interrupt latency per channel */
+#define ACQUIRE_TIMEOUT		(HZ / 100)	/* Stuck I2C transfer */
+#define ACQUIRE_JITTER_BUCKETS	13		/* 0, 1, 2-3, ..., >= 2048 us */
+#define CYCLES_PER_US		(F_CPU / 1000000)
+
+/*
+ * The acquisition task only kicks off a sampling sequence.  The sequence
+ * itself runs from the I2C completion interrupts, reading the shunt and bus
+ * voltages of all enabled channels back-to-back, and storing the samples in
+ * per-channel ring buffers, to be consumed by the main loop.
+ *
+ * Each ring buffer has a single producer (the I2C interrupt handler) and a
+ * single consumer (acquire_get()).  head and tail are free-running, and only
+ * written by the producer resp. consumer.
+ *
+ * The ring buffers share a pool of ACQUIRE_POOL_SIZE samples, divided over
+ * the enabled channels.  With more channels, each channel is sampled less
+ * often, so it needs less buffering.
+ */
+struct acquire_sample {
+	uint32_t t;		// Timestamp (µs)
+	struct ina219_raw raw;
+};
+
+static struct acquire_sample acquire_pool[ACQUIRE_POOL_SIZE];
+
+static struct acquire_ring {
+	struct acquire_sample *samples;
+	unsigned int size;	// Power of two
+	volatile unsigned int head, tail;
+	/* Statistics */
+	volatile unsigned int count, dropped, errors;
+	/* Deviation of the sample interval from the period */
+	uint32_t last_t;
+	uint8_t last_valid;
+	unsigned int jitter[ACQUIRE_JITTER_BUCKETS];
+} rings[INA219_MAX];
+
+/*
+ * Samples are timestamped from the cycle counter, extended to a µs clock in
+ * the micros() time base.  Both count core clock cycles, so they don't
+ * drift apart.  The clock must be advanced at least once per cycle counter
+ * wrap-around (2^32 / F_CPU s), which the acquisition task does every
+ * period.  Must be called with interrupts disabled.
+ */
+static struct {
+	uint32_t cycles;	// Cycle counter at the last update
+	uint32_t rem;		// Cycles not yet accounted for in us
+	uint32_t us;
+} acquire_clock;
+
+static uint32_t acquire_timestamp(void)
+{
+	uint32_t now = ARM_DWT_CYCCNT;
+
+	acquire_clock.rem += now - acquire_clock.cycles;
+	acquire_clock.cycles = now;
+	acquire_clock.us += acquire_clock.rem / CYCLES_PER_US;
+	acquire_clock.rem %= CYCLES_PER_US;
+	return acquire_clock.us;
+}
+
+static unsigned int acquire_mask;	// Channels to sample
+static unsigned int acquire_period;	// us
+static struct ina219_raw acquire_raw;
+static volatile int acquire_busy;
+static uint32_t acquire_busy_start;
+static unsigned int acquire_overruns, acquire_timeouts;
+static uint32_t acquire_stats_start;	// ms
+
+static void acquire_done(unsigned int ch, int error);
+
+/* Start sampling the next enabled channel, starting at ch */
+static void acquire_next(unsigned int ch)
+{
+	for (; ch < INA219_MAX; ch++) {
+		if (!(acquire_mask & BIT(ch)))
+			continue;
+
+		if (!ina219_read_async(ch, &acquire_raw, acquire_done))
+			return;
+
+		rings[ch].errors++;
+	}
+
+	acquire_busy = 0;
+}
+
+static void acquire_account_jitter(struct acquire_ring *ring, uint32_t t)
+{
+	uint32_t dt = t - ring->last_t, jitter;
+	unsigned int i;
+
+	ring->last_t = t;
+	if (!ring->last_valid) {
+		ring->last_valid = 1;
+		return;
+	}
+
+	jitter = dt > acquire_period ? dt - acquire_period
+				     : acquire_period - dt;
+	i = jitter ? 32 - __builtin_clz(jitter) : 0;
+	if (i >= ACQUIRE_JITTER_BUCKETS)
+		i = ACQUIRE_JITTER_BUCKETS - 1;
+	ring->jitter[i]++;
+}
+
+/* Called from interrupt context, right after the conversion has been read */
+static void acquire_done(unsigned int ch, int error)
+{
+	struct acquire_ring *ring = &rings[ch];
+	unsigned int h = ring->head;
+	struct acquire_sample *sample;
+	uint32_t t = acquire_timestamp();
+
+	if (!error) {
+		acquire_account_jitter(ring, t);
+		capture_add(ch, t, &acquire_raw);
+		alarm_check(ch, t, &acquire_raw);
+	}
+
+	if (error) {
+		// Don't count the gap as jitter
+		ring->last_valid = 0;
+		ring->errors++;
+	} else if (h - ring->tail >= ring->size) {
+		ring->dropped++;
+	} else {
+		sample = &ring->samples[h % ring->size];
+		sample->t = t;
+		sample->raw = acquire_raw;
+		/* Make sure the sample is visible before publishing it */
+		__sync_synchronize();
+		ring->head = h + 1;
+		ring->count++;
+	}
+
+	acquire_next(ch + 1);
+}
+
+static struct task task_acquire;
+
+static int acquire(void)
+{
+	// The period of a queued task can only be changed when it runs
+	task_acquire.period = acquire_period;
+
+	// Keep the timestamp clock going, even if no samples are taken
+	__disable_irq();
+	acquire_timestamp();
+	__enable_irq();
+
+	if (acquire_busy) {
+		acquire_overruns++;
+		if (micros() - acquire_busy_start > ACQUIRE_TIMEOUT) {
+			acquire_timeouts++;
+			twi_asyncAbort();
+		}
+		return 0;
+	}
+
+	acquire_busy = 1;
+	acquire_busy_start = micros();
+	acquire_next(0);
+	return 0;
+}
+
+static struct task task_acquire = {
+	.name = "acquire",
+	.func = acquire,
+	.policy = TASK_SKIP_MISSED,
+	.prio = TASK_PRIO_HIGH,
+};
+
+/* Retrieve the oldest sample of a channel, return 1 if available */
+int acquire_get(unsigned int ch, uint32_t *t, struct ina219_raw *raw)
+{
+	struct acquire_ring *ring = &rings[ch];
+	unsigned int i = ring->tail;
+	const struct acquire_sample *sample;
+
+	if (i == ring->head)
+		return 0;
+
+	__sync_synchronize();
+	sample = &ring->samples[i % ring->size];
+	*t = sample->t;
+	*raw = sample->raw;
+	/* Release the entry after copying */
+	__sync_synchronize();
+	ring->tail = i + 1;
+	return 1;
+}
+
+void acquire_show_stats(void)
+{
+	uint32_t ms = millis() - acquire_stats_start;
+	const struct acquire_ring *ring;
+	unsigned int ch, i, lo, hi;
+
+	printf("Ch  Samples     Rate  Dropped  Errors\n");
+	for (ch = 0; ch < INA219_MAX; ch++) {
+		if (!(acquire_mask & BIT(ch)))
+			continue;
+
+		ring = &rings[ch];
+		printf("%c  %8u  %4" PRIu32 " Hz  %7u  %6u\n", 'A' + ch, ring->count,
+		       ms ? (uint32_t)((uint64_t)ring->count * 1000 / ms) : 0,
+		       ring->dropped, ring->errors);
+	}
+	printf("Period %u us, %u overruns, %u timeouts\n", acquire_period,
+	       acquire_overruns, acquire_timeouts);
+
+	printf("Jitter (us)  ");
+	for (ch = 0; ch < INA219_MAX; ch++)
+		if (acquire_mask & BIT(ch))
+			printf("  %8c", 'A' + ch);
+	printf("\n");
+	for (i = 0; i < ACQUIRE_JITTER_BUCKETS; i++) {
+		lo = i ? BIT(i - 1) : 0;
+		hi = i ? BIT(i) - 1 : 0;
+		if (i == ACQUIRE_JITTER_BUCKETS - 1)
+			printf("%5u-       ", lo);
+		else
+			printf("%5u-%-5u  ", lo, hi);
+		for (ch = 0; ch < INA219_MAX; ch++)
+			if (acquire_mask & BIT(ch))
+				printf("  %8u", rings[ch].jitter[i]);
+		printf("\n");
+	}
+}
+
+void acquire_reset_stats(void)
+{
+	unsigned int ch;
+
+	for (ch = 0; ch < INA219_MAX; ch++) {
+		rings[ch].count = rings[ch].dropped = rings[ch].errors = 0;
+		memset(rings[ch].jitter, 0, sizeof(rings[ch].jitter));
+	}
+	acquire_overruns = acquire_timeouts = 0;
+	acquire_stats_start = millis();
+}
+
+/*
+ * Sample every period_us, which should be the INA219 conversion time, so
+ * each sample is a new conversion result.  But don't start sampling
+ * sequences faster than the I2C bus can handle at its configured frequency.
+ */
+void acquire_set_period(unsigned int period_us)
+{
+	uint32_t freq = twi_getFrequency();
+	unsigned int min_us = __builtin_popcount(acquire_mask) *
+			      ((ACQUIRE_CH_BITS * 1000000 + freq - 1) / freq +
+			       ACQUIRE_CH_MARGIN_US);
+
+	acquire_period = period_us > min_us ? period_us : min_us;
+}
+
+/* Start continuous sampling of the channels in mask */
+void acquire_start(unsigned int mask, unsigned int period_us)
+{
+	unsigned int ch, size = ACQUIRE_POOL_SIZE, n = 0;
+
+	// Largest power of two that fits all channels
+	while (size * __builtin_popcount(mask) > ACQUIRE_POOL_SIZE)
+		size >>= 1;
+
+	for (ch = 0; ch < INA219_MAX; ch++) {
+		if (!(mask & BIT(ch)))
+			continue;
+
+		rings[ch].samples = &acquire_pool[n];
+		rings[ch].size = size;
+		n += size;
+	}
+
+	// The cycle counter may not have been enabled by the scheduler yet
+	ARM_DEMCR |= ARM_DEMCR_TRCENA;
+	ARM_DWT_CTRL |= ARM_DWT_CTRL_CYCCNTENA;
+	acquire_clock.cycles = ARM_DWT_CYCCNT;
+	acquire_clock.rem = 0;
+	acquire_clock.us = micros();
+
+	acquire_mask = mask;
+	acquire_set_period(period_us);
+	task_acquire.period = acquire_period;
+	acquire_reset_stats();
+	task_add(&task_acquire);
+}
@@ -0,0 +1,20 @@
+//
+// Power Monitor Sample Acquisition
+//
+// © Copyright 2026 Glider bv
+//
+// This file is subject to the terms and conditions of the GNU General Public
+// License, version 2.
+//
+
+#include <stdint.h>
+
+#define ACQUIRE_POOL_SIZE	256	/* Samples of all channels, power of two */
+
+struct ina219_raw;
+
+extern void acquire_start(unsigned int mask, unsigned int period_us);
+extern void acquire_set_period(unsigned int period_us);
+extern int acquire_get(unsigned int ch, uint32_t *t, struct ina219_raw *raw);
+extern void acquire_show_stats(void);
+extern void acquire_reset_stats(void);
@@ -0,0 +1,369 @@
+//
+// Power Alarms
+//
+// © Copyright 2026 Glider bv
+//
+// This file is subject to the terms and conditions of the GNU General Public
+// License, version 2.
+//
+
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "alarm.h"
+#include "board.h"
+#include "capture.h"
+#include "cmd.h"
+#include "env.h"
+#include "ina219.h"
+#include "print.h"
+#include "task.h"
+#include "util.h"
+#include "work.h"
+
+/*
+ * Every acquired sample of a powered channel is checked against the
+ * configured over-current, under-voltage, and over-power thresholds, from
+ * interrupt context.  When a threshold has been exceeded continuously for
+ * the hold-off time, the channel is powered off, and an event is logged.
+ * The rest of the firmware is told about the power cut-off, and the event
+ * is reported, from the main loop, through deferred work.
+ * Hence the reaction time is bounded by the hold-off time plus one
+ * acquisition period.
+ *
+ * A tripped channel stays off until it is powered on again.
+ */
+enum alarm_kind {
+	ALARM_CURRENT,
+	ALARM_VOLTAGE,
+	ALARM_POWER,
+	ALARM_NUM
+};
+
+static const struct {
+	const char *name;
+	const char *unit;
+} alarm_kinds[ALARM_NUM] = {
+	[ALARM_CURRENT] = { "over-current", "uA" },
+	[ALARM_VOLTAGE] = { "under-voltage", "mV" },
+	[ALARM_POWER] = { "over-power", "uW" },
+};
+
+struct alarm_cfg {
+	int32_t limit[ALARM_NUM];	// µA, mV, µW, zero if disabled
+	uint32_t holdoff;		// µs
+};
+
+static struct alarm {
+	struct alarm_cfg cfg;
+	uint32_t start[ALARM_NUM];	// µs, when the threshold was exceeded
+	int32_t peak[ALARM_NUM];	// Worst value since then
+	uint8_t pending;		// Thresholds currently exceeded
+	volatile uint8_t armed;		// Powered, and not tripped
+	volatile uint8_t tripped;
+	volatile uint8_t cut;		// Powered off, not yet handled
+} alarms[NUM_POWER_CH];
+
+struct alarm_event {
+	uint32_t ms;		// Time of the power cut-off
+	uint32_t duration;	// µs, since the threshold was exceeded
+	int32_t peak;
+	uint8_t ch;
+	uint8_t kind;
+};
+
+static struct alarm_event alarm_log[ALARM_LOG_SIZE];
+static volatile unsigned int alarm_head;	// Number of events logged
+static unsigned int alarm_reported;
+
+static void alarm_kick(unsigned long data);
+
+static int alarm_exceeded(enum alarm_kind kind, int32_t limit, int32_t x)
+{
+	return kind == ALARM_VOLTAGE ? x < limit : x > limit;
+}
+
+/* Called from interrupt context */
+static void alarm_trip(unsigned int ch, enum alarm_kind kind, uint32_t t)
+{
+	struct alarm *a = &alarms[ch];
+	struct alarm_event *e;
+
+	digitalWrite(pin_power[ch], 0);
+	a->armed = 0;
+	a->tripped = 1;
+	a->cut = 1;
+
+	e = &alarm_log[alarm_head % ALARM_LOG_SIZE];
+	e->ms = millis();
+	e->duration = t - a->start[kind];
+	e->peak = a->peak[kind];
+	e->ch = ch;
+	e->kind = kind;
+	alarm_head++;
+
+	work_post(alarm_kick, 0);
+}
+
+/* Check a sample, called from interrupt context */
+void alarm_check(unsigned int ch, uint32_t t, const struct ina219_raw *raw)
+{
+	struct alarm *a;
+	unsigned int kind;
+	int32_t x, limit;
+
+	// Only the power channels can be switched off
+	if (ch >= NUM_POWER_CH)
+		return;
+
+	a = &alarms[ch];
+	if (!a->armed)
+		return;
+
+	for (kind = 0; kind < ALARM_NUM; kind++) {
+		limit = a->cfg.limit[kind];
+		if (!limit)
+			continue;
+
+		switch (kind) {
+		case ALARM_CURRENT:
+			x = ina219_current_uA(ch, raw);
+			break;
+		case ALARM_VOLTAGE:
+			x = ina219_bus_mV(ch, raw);
+			break;
+		default:
+			x = ina219_power_uW(ch, raw);
+			break;
+		}
+
+		if (!alarm_exceeded(kind, limit, x)) {
+			a->pending &= ~BIT(kind);
+			continue;
+		}
+
+		if (!(a->pending & BIT(kind))) {
+			a->pending |= BIT(kind);
+			a->start[kind] = t;
+			a->peak[kind] = x;
+		} else if (alarm_exceeded(kind, a->peak[kind], x)) {
+			a->peak[kind] = x;
+		}
+
+		if (t - a->start[kind] >= a->cfg.holdoff) {
+			alarm_trip(ch, kind, t);
+			return;
+		}
+	}
+}
+
+/* Called when a channel is powered on or off */
+void alarm_power(unsigned int ch, int state)
+{
+	struct alarm *a = &alarms[ch];
+
+	__disable_irq();
+	a->pending = 0;
+	a->tripped = 0;
+	a->cut = 0;
+	a->armed = state;
+	__enable_irq();
+}
+
+int alarm_tripped(unsigned int ch)
+{
+	return alarms[ch].tripped;
+}
+
+static void alarm_print_event(const struct alarm_event *e)
+{
+	printf("%c: %s at %" PRIu32 " ms, peak %" PRId32 " %s after %" PRIu32
+	       " us, powered off\n",
+	       'A' + e->ch, alarm_kinds[e->kind].name, e->ms, e->peak,
+	       alarm_kinds[e->kind].unit, e->duration);
+}
+
+/*
+ * Report new events, unless that would corrupt a stream or the output of a
+ * background command, in which case try again later
+ */
+static int alarm_report(void)
+{
+	unsigned int head = alarm_head;
+
+	if (!cmd_may_print())
+		return 0;
+
+	if (head - alarm_reported > ALARM_LOG_SIZE)
+		alarm_reported = head - ALARM_LOG_SIZE;
+
+	for (; alarm_reported != head; alarm_reported++) {
+		printf(ESC_RED "Alarm ");
+		alarm_print_event(&alarm_log[alarm_reported % ALARM_LOG_SIZE]);
+		printf(ESC_NORMAL);
+	}
+
+	return TASK_DONE;
+}
+
+static struct task task_alarm = {
+	.name = "alarm",
+	.func = alarm_report,
+	.period = HZ / 10,
+	.policy = TASK_SKIP_MISSED,
+};
+
+/* Deferred work, posted when a channel trips */
+static void alarm_kick(unsigned long data)
+{
+	unsigned int ch;
+
+	for (ch = 0; ch < NUM_POWER_CH; ch++) {
+		if (!alarms[ch].cut)
+			continue;
+
+		// A tripped channel cannot trip again until powered on
+		alarms[ch].cut = 0;
+		cmd_power_cut(ch);
+		capture_power(ch, 0);
+	}
+
+	task_add(&task_alarm);
+}
+
+static int param_is(const char *s, size_t n, const char *name)
+{
+	return n == strlen(name) && !strncmp(s, name, n);
+}
+
+/*
+ * Parse a comma-separated list of alarm parameters, e.g.
+ * "imax=500,vmin=4500,pmax=2500,hold=2", with the maximum current in mA,
+ * the minimum bus voltage in mV, the maximum power in mW, and the hold-off
+ * time in ms.  A zero threshold disables the alarm.
+ */
+static int alarm_parse_params(const char *s, struct alarm_cfg *cfg)
+{
+	unsigned long x;
+	const char *val;
+	char *end;
+	size_t n;
+
+	while (*s) {
+		n = strcspn(s, "=,");
+		if (s[n] != '=')
+			goto error;
+
+		val = s + n + 1;
+		x = strtoul(val, &end, 10);
+		if (end == val || x > INT32_MAX / 1000)
+			goto error;
+
+		if (param_is(s, n, "imax"))
+			cfg->limit[ALARM_CURRENT] = x * 1000;
+		else if (param_is(s, n, "vmin"))
+			cfg->limit[ALARM_VOLTAGE] = x;
+		else if (param_is(s, n, "pmax"))
+			cfg->limit[ALARM_POWER] = x * 1000;
+		else if (param_is(s, n, "hold"))
+			cfg->holdoff = x * 1000;
+		else
+			goto error;
+
+		if (*end == ',')
+			end++;
+		else if (*end)
+			goto error;
+		s = end;
+	}
+
+	return 0;
+
+error:
+	pr_err("Invalid alarm parameters %s\n", s);
+	return -1;
+}
+
+static void alarm_show_limit(const char *name, int32_t limit,
+			     unsigned int div, const char *unit)
+{
+	if (limit)
+		printf(", %s %" PRId32 " %s", name, limit / (int32_t)div, unit);
+	else
+		printf(", %s off", name);
+}
+
+/*
+ * Show the configuration of the selected channel (all if ch < 0), or
+ * reconfigure it using the parameters in argv[]
+ */
+int alarm_config(int ch, int argc, char *argv[])
+{
+	struct alarm_cfg cfg;
+	const struct alarm *a;
+	unsigned int i;
+	int j;
+
+	for (i = 0; i < NUM_POWER_CH; i++) {
+		if (ch >= 0 && i != ch)
+			continue;
+
+		a = &alarms[i];
+		if (argc) {
+			cfg = a->cfg;
+			for (j = 0; j < argc; j++)
+				if (alarm_parse_params(argv[j], &cfg))
+					return -1;
+
+			__disable_irq();
+			alarms[i].cfg = cfg;
+			alarms[i].pending = 0;
+			__enable_irq();
+		}
+
+		printf("%c: %s", 'A' + i,
+		       a->tripped ? "tripped" : a->armed ? "armed" : "off");
+		alarm_show_limit("imax", a->cfg.limit[ALARM_CURRENT], 1000,
+				 "mA");
+		alarm_show_limit("vmin", a->cfg.limit[ALARM_VOLTAGE], 1, "mV");
+		alarm_show_limit("pmax", a->cfg.limit[ALARM_POWER], 1000,
+				 "mW");
+		printf(", hold %" PRIu32 " ms\n", a->cfg.holdoff / 1000);
+	}
+
+	return 0;
+}
+
+/* Show the configuration of all channels, and the event log */
+void alarm_show(void)
+{
+	unsigned int i, head = alarm_head;
+
+	alarm_config(-1, 0, NULL);
+
+	i = head > ALARM_LOG_SIZE ? head - ALARM_LOG_SIZE : 0;
+	printf("%u events\n", head);
+	for (; i != head; i++)
+		alarm_print_event(&alarm_log[i % ALARM_LOG_SIZE]);
+}
+
+void alarm_clear(void)
+{
+	__disable_irq();
+	alarm_head = alarm_reported = 0;
+	__enable_irq();
+}
+
+void alarm_init(void)
+{
+	static const char *const keys[NUM_POWER_CH] = { "alarmA", "alarmB" };
+	const char *var;
+	unsigned int ch;
+
+	for (ch = 0; ch < NUM_POWER_CH; ch++) {
+		var = env_get(keys[ch]);
+		if (var)
+			alarm_parse_params(var, &alarms[ch].cfg);
+	}
+}
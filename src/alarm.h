@@ -0,0 +1,23 @@
+//
+// Power Alarms
+//
+// © Copyright 2026 Glider bv
+//
+// This file is subject to the terms and conditions of the GNU General Public
+// License, version 2.
+//
+
+#include <stdint.h>
+
+#define ALARM_LOG_SIZE		16	/* Must be a power of two */
+
+struct ina219_raw;
+
+extern void alarm_init(void);
+extern int alarm_config(int ch, int argc, char *argv[]);
+extern void alarm_show(void);
+extern void alarm_clear(void);
+extern int alarm_tripped(unsigned int ch);
+extern void alarm_power(unsigned int ch, int state);
+extern void alarm_check(unsigned int ch, uint32_t t,
+			const struct ina219_raw *raw);
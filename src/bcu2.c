@@ -12,6 +12,7 @@
 #include <usb_serial2.h>
 #include <usb_serial3.h>
 
+#include "alarm.h"
 #include "board.h"
 #include "cmd.h"
 #include "env.h"
@@ -86,6 +87,15 @@ static void console_init(void)
 	serial2_begin(BAUD2DIV2(get_baud("baudB")));
 }
 
+static void i2c_init(void)
+{
+	const char *var = env_get("i2cfreq");
+
+	twi_init();
+	if (var && atoi(var) > 0)
+		twi_setFrequency(atoi(var));
+}
+
 /*****************************************************************************/
 
 void usb_serial_event(void)
@@ -235,6 +245,7 @@ static struct task task_heartbeat = {
 	.name = "heartbeat",
 	.func = blink,
 	.period = HZ / 100,
+	.policy = TASK_RESCHEDULE,
 };
 
 static void leds_init(void)
@@ -272,7 +283,8 @@ int main(int argc, char *argv[])
 {
 	env_init();
 	leds_init();
-	twi_init();
+	i2c_init();
+	alarm_init();
 	measure_init();
 	console_init();
 	input_init();
@@ -0,0 +1,301 @@
+//
+// Power Trace Capture
+//
+// © Copyright 2026 Glider bv
+//
+// This file is subject to the terms and conditions of the GNU General Public
+// License, version 2.
+//
+
+#include <inttypes.h>
+
+#include "capture.h"
+#include "cmd.h"
+#include "ina219.h"
+#include "print.h"
+#include "pt.h"
+#include "task.h"
+#include "util.h"
+
+#define CAPTURE_DUMP_BURST	16	/* Samples dumped per task run */
+
+/*
+ * While armed, all acquired samples are recorded in a ring buffer, until the
+ * trigger fires.  Then recording continues until the requested number of
+ * post-trigger samples has been stored, which never overwrites the requested
+ * number of pre-trigger samples.
+ *
+ * Samples are added from interrupt context, so the ring buffer is only
+ * accessed from the main loop after recording has stopped.
+ */
+enum capture_state {
+	CAPTURE_IDLE,
+	CAPTURE_ARMED,
+	CAPTURE_TRIGGERED,
+	CAPTURE_DONE,
+};
+
+struct capture_sample {
+	uint32_t t;		// µs
+	int16_t shunt;		// Shunt Voltage Register
+	uint16_t bus;		// Bus Voltage Register
+	uint8_t ch;
+};
+
+static struct capture_sample capture_buf[CAPTURE_MAX];
+
+static struct {
+	volatile uint8_t state;
+	enum capture_trig trig;
+	int ch;			// Trigger channel, or -1 for all
+	int level_uA;		// Trigger level
+	uint8_t cond[INA219_MAX];	// Trigger condition was met
+	unsigned int pre, post;
+	volatile unsigned int head;	// Number of samples recorded
+	unsigned int trig_idx;	// Index of the first post-trigger sample
+	uint32_t trig_t;	// Trigger time (µs)
+} capture;
+
+static const char *const capture_states[] = {
+	[CAPTURE_IDLE] = "idle",
+	[CAPTURE_ARMED] = "armed",
+	[CAPTURE_TRIGGERED] = "triggered",
+	[CAPTURE_DONE] = "done",
+};
+
+static const char *const capture_trigs[] = {
+	[CAPTURE_TRIG_MANUAL] = "manual",
+	[CAPTURE_TRIG_POWER] = "power",
+	[CAPTURE_TRIG_ABOVE] = "above",
+	[CAPTURE_TRIG_BELOW] = "below",
+};
+
+/* Must be called with interrupts disabled, or from interrupt context */
+static void capture_fire(unsigned int idx, uint32_t t)
+{
+	capture.trig_idx = idx;
+	capture.trig_t = t;
+	capture.state = capture.post ? CAPTURE_TRIGGERED : CAPTURE_DONE;
+}
+
+/* Record a sample, called from interrupt context */
+void capture_add(unsigned int ch, uint32_t t, const struct ina219_raw *raw)
+{
+	struct capture_sample *sample;
+	unsigned int idx;
+	int cond;
+
+	if (capture.state != CAPTURE_ARMED &&
+	    capture.state != CAPTURE_TRIGGERED)
+		return;
+
+	idx = capture.head++;
+	sample = &capture_buf[idx % CAPTURE_MAX];
+	sample->t = t;
+	sample->shunt = raw->shunt;
+	sample->bus = raw->bus;
+	sample->ch = ch;
+
+	if (capture.state == CAPTURE_TRIGGERED) {
+		if (capture.head - capture.trig_idx >= capture.post)
+			capture.state = CAPTURE_DONE;
+		return;
+	}
+
+	if (capture.trig != CAPTURE_TRIG_ABOVE &&
+	    capture.trig != CAPTURE_TRIG_BELOW)
+		return;
+
+	if (capture.ch >= 0 && ch != capture.ch)
+		return;
+
+	// Trigger on the edge, not on the level
+	if (capture.trig == CAPTURE_TRIG_ABOVE)
+		cond = ina219_current_uA(ch, raw) > capture.level_uA;
+	else
+		cond = ina219_current_uA(ch, raw) < capture.level_uA;
+	if (cond && !capture.cond[ch]) {
+		capture_fire(idx, t);
+		if (capture.head - capture.trig_idx >= capture.post)
+			capture.state = CAPTURE_DONE;
+	}
+	capture.cond[ch] = cond;
+}
+
+/*
+ * Start recording, keeping pre samples before, and post samples after the
+ * trigger.  ch selects the channel for the trigger (-1 for all).
+ */
+int capture_arm(enum capture_trig trig, int ch, int level_uA,
+		unsigned int pre, unsigned int post)
+{
+	unsigned int i;
+
+	if (pre + post > CAPTURE_MAX || pre > CAPTURE_MAX ||
+	    post > CAPTURE_MAX) {
+		printf("Capture too large, max %u samples\n", CAPTURE_MAX);
+		return -1;
+	}
+
+	__disable_irq();
+	capture.state = CAPTURE_IDLE;
+	__enable_irq();
+
+	capture.trig = trig;
+	capture.ch = ch;
+	capture.level_uA = level_uA;
+	// Don't trigger if the condition is already met
+	for (i = 0; i < INA219_MAX; i++)
+		capture.cond[i] = 1;
+	capture.pre = pre;
+	capture.post = post;
+	capture.head = 0;
+	__sync_synchronize();
+	capture.state = CAPTURE_ARMED;
+	return 0;
+}
+
+void capture_trigger(void)
+{
+	__disable_irq();
+	if (capture.state == CAPTURE_ARMED)
+		capture_fire(capture.head, micros());
+	__enable_irq();
+}
+
+/* Power switch event */
+void capture_power(unsigned int ch, int state)
+{
+	if (capture.trig == CAPTURE_TRIG_POWER &&
+	    (capture.ch < 0 || capture.ch == ch))
+		capture_trigger();
+}
+
+/* Index of the first pre-trigger sample */
+static unsigned int capture_first(void)
+{
+	if (capture.trig_idx < capture.pre)
+		return 0;
+
+	return capture.trig_idx - capture.pre;
+}
+
+void capture_show(void)
+{
+	unsigned int state = capture.state;
+
+	printf("Capture %s, trigger %s", capture_states[state],
+	       capture_trigs[capture.trig]);
+	if (capture.ch >= 0)
+		printf(" on channel %c", 'A' + capture.ch);
+	if (capture.trig == CAPTURE_TRIG_ABOVE ||
+	    capture.trig == CAPTURE_TRIG_BELOW)
+		printf(" %d mA", capture.level_uA / 1000);
+	printf(", %u pre, %u post samples\n", capture.pre, capture.post);
+
+	if (state == CAPTURE_IDLE)
+		return;
+
+	printf("%u samples recorded", capture.head);
+	if (state == CAPTURE_DONE)
+		printf(", %u available", capture.head - capture_first());
+	printf("\n");
+}
+
+/*
+ * Binary dump format, in native (little) endian:
+ *   - Header: "BFFC", uint16_t number of samples, uint16_t sample size,
+ *   - Samples: int32_t time relative to the trigger (µs),
+ *              int32_t current (µA), uint16_t bus voltage (mV),
+ *              uint8_t channel, uint8_t reserved.
+ */
+struct capture_hdr {
+	char magic[4];
+	uint16_t num;
+	uint16_t size;
+};
+
+struct capture_rec {
+	int32_t t;
+	int32_t current_uA;
+	uint16_t vbus_mV;
+	uint8_t ch;
+	uint8_t reserved;
+};
+
+static struct pt capture_dump_pt;
+static unsigned int capture_dump_idx, capture_dump_binary;
+
+static void capture_dump_sample(const struct capture_sample *sample)
+{
+	struct ina219_raw raw = { .shunt = sample->shunt, .bus = sample->bus };
+	struct capture_rec rec = {
+		.t = sample->t - capture.trig_t,
+		.current_uA = ina219_current_uA(sample->ch, &raw),
+		.vbus_mV = ina219_bus_mV(sample->ch, &raw),
+		.ch = sample->ch,
+	};
+
+	if (capture_dump_binary)
+		usb_serial_write(&rec, sizeof(rec));
+	else
+		printf("%" PRId32 ",%c,%u,%" PRId32 "\n", rec.t, 'A' + rec.ch, rec.vbus_mV,
+		       rec.current_uA);
+}
+
+static int capture_dump_run(void)
+{
+	struct pt *pt = &capture_dump_pt;
+	struct capture_hdr hdr = {
+		.magic = { 'B', 'F', 'F', 'C' },
+		.num = capture.head - capture_first(),
+		.size = sizeof(struct capture_rec),
+	};
+	unsigned int i;
+
+	PT_BEGIN(pt);
+
+	if (capture_dump_binary)
+		usb_serial_write(&hdr, sizeof(hdr));
+	else
+		printf("t_us,ch,vbus_mV,current_uA\n");
+
+	for (capture_dump_idx = capture_first();
+	     capture_dump_idx != capture.head; ) {
+		/* Interrupted by CTRL-C? */
+		if (cmd_mode != CMD_BUSY)
+			PT_EXIT(pt);
+
+		for (i = 0; i < CAPTURE_DUMP_BURST &&
+			    capture_dump_idx != capture.head; i++)
+			capture_dump_sample(&capture_buf[capture_dump_idx++ %
+							 CAPTURE_MAX]);
+
+		PT_YIELD(pt);
+	}
+
+	cmd_done();
+
+	PT_END(pt);
+}
+
+static struct task task_capture_dump = {
+	.name = "capture dump",
+	.func = capture_dump_run,
+	.period = 0,
+	.policy = TASK_RESCHEDULE,
+};
+
+/* Dump the capture in the background, as CSV or binary */
+void capture_dump(int binary)
+{
+	if (capture.state != CAPTURE_DONE) {
+		printf("No capture available\n");
+		return;
+	}
+
+	capture_dump_binary = binary;
+	PT_INIT(&capture_dump_pt);
+	cmd_mode = CMD_BUSY;
+	task_add(&task_capture_dump);
+}
@@ -0,0 +1,30 @@
+//
+// Power Trace Capture
+//
+// © Copyright 2026 Glider bv
+//
+// This file is subject to the terms and conditions of the GNU General Public
+// License, version 2.
+//
+
+#include <stdint.h>
+
+#define CAPTURE_MAX		2048	/* Samples of all channels, 24 KiB */
+
+enum capture_trig {
+	CAPTURE_TRIG_MANUAL,	// "capture trigger" only
+	CAPTURE_TRIG_POWER,	// Power switched on or off
+	CAPTURE_TRIG_ABOVE,	// Current rises above level
+	CAPTURE_TRIG_BELOW,	// Current falls below level
+};
+
+struct ina219_raw;
+
+extern int capture_arm(enum capture_trig trig, int ch, int level_uA,
+		       unsigned int pre, unsigned int post);
+extern void capture_trigger(void);
+extern void capture_power(unsigned int ch, int state);
+extern void capture_add(unsigned int ch, uint32_t t,
+			const struct ina219_raw *raw);
+extern void capture_show(void);
+extern void capture_dump(int binary);
@@ -12,14 +12,24 @@
 #include <twi.h>
 #include <usb_names.h>
 
+#include "acquire.h"
+#include "alarm.h"
 #include "board.h"
+#include "capture.h"
 #include "cmd.h"
 #include "env.h"
+#include "ina219.h"
+#include "ina219sim.h"
 #include "input.h"
+#include "measure.h"
 #include "print.h"
+#include "pt.h"
 #include "rgb.h"
+#include "stream.h"
+#include "task.h"
 #include "util.h"
 #include "version.h"
+#include "work.h"
 
 #define ARGV_MAX	10
 
@@ -38,17 +48,24 @@ static struct cmd commands[];
 
 static int decode_channel(const char *arg, const char *name, unsigned int n)
 {
+	unsigned long x;
+	char *end;
 	char c;
 
 	if (!part_strncasecmp(arg, "ALL", 2))
 		return -1;
 
+	if (isdigit(arg[0])) {
+		x = strtoul(arg, &end, 10);
+		if (*end || x >= n)
+			goto error;
+		return x;
+	}
+
 	if (arg[1])
 		goto error;
 
 	c = arg[0];
-	if (c >= '0' && c < '0' + n)
-		return c - '0';
 
 	if (c >= 'A' && c < 'A' + n)
 		return c - 'A';
@@ -148,6 +165,19 @@ static void cmd_saveenv(int argc, char *argv[])
 	env_save();
 }
 
+static void cmd_stats(int argc, char *argv[])
+{
+	if (argc > 1 || (argc && part_strncasecmp(argv[0], "reset", 1))) {
+		printf("Usage: stats [reset]\n");
+		return;
+	}
+
+	if (argc)
+		task_reset_idle_stats();
+	else
+		task_show_idle_stats();
+}
+
 static void cmd_start(int mode, const char *name)
 {
 	printf("Starting %s (CTRL-C to interrupt)\n", name);
@@ -156,7 +186,239 @@ static void cmd_start(int mode, const char *name)
 
 static void cmd_monitor(int argc, char *argv[])
 {
-	cmd_start(CMD_MONITOR, "power monitor");
+	unsigned int num_ch = ina219_num_channels();
+	int ch = -1;
+
+	if (!argc) {
+		cmd_start(CMD_MONITOR, "power monitor");
+		return;
+	}
+
+	if (!part_strncasecmp(argv[0], "stats", 1) && argc <= 2) {
+		if (argc == 1) {
+			acquire_show_stats();
+			ina219_show_stats();
+			stream_show_stats();
+			return;
+		}
+
+		if (!part_strncasecmp(argv[1], "reset", 1)) {
+			acquire_reset_stats();
+			ina219_reset_stats();
+			stream_reset_stats();
+			return;
+		}
+	}
+
+	if (!part_strncasecmp(argv[0], "stream", 3) && argc <= 2) {
+		if (argc == 1 || !part_strncasecmp(argv[1], "csv", 1)) {
+			/* No prose, the stream starts with its header */
+			cmd_mode = CMD_STREAM;
+			stream_start(0);
+			return;
+		}
+
+		if (!part_strncasecmp(argv[1], "binary", 1)) {
+			cmd_mode = CMD_STREAM;
+			stream_start(1);
+			return;
+		}
+	}
+
+	if (!part_strncasecmp(argv[0], "energy", 1) && argc <= 3) {
+		if (argc > 1) {
+			ch = decode_channel(argv[1], "monitor", num_ch);
+			if (ch < -1)
+				return;
+		}
+
+		if (argc < 3) {
+			measure_show_energy(ch);
+			return;
+		}
+
+		if (!part_strncasecmp(argv[2], "reset", 1)) {
+			measure_reset_energy(ch);
+			return;
+		}
+	}
+
+	if (!part_strncasecmp(argv[0], "interval", 1) && argc <= 2) {
+		if (argc == 1)
+			measure_show_interval();
+		else
+			measure_set_interval(strtoul(argv[1], NULL, 0));
+		return;
+	}
+
+	if (!part_strncasecmp(argv[0], "windows", 1) && argc <= 2) {
+		if (argc == 1)
+			measure_show_interval();
+		else
+			measure_set_windows(argv[1]);
+		return;
+	}
+
+	if (!part_strncasecmp(argv[0], "peaks", 1) && argc <= 3) {
+		if (argc > 1) {
+			ch = decode_channel(argv[1], "monitor", num_ch);
+			if (ch < -1)
+				return;
+		}
+
+		if (argc < 3) {
+			measure_show_stats(ch);
+			return;
+		}
+
+		if (!part_strncasecmp(argv[2], "reset", 1)) {
+			measure_reset_stats(ch);
+			return;
+		}
+	}
+
+	if (!part_strncasecmp(argv[0], "config", 1)) {
+		if (argc > 1) {
+			ch = decode_channel(argv[1], "monitor", num_ch);
+			if (ch < -1)
+				return;
+		}
+
+		measure_config(ch, argc > 2 ? argc - 2 : 0, argv + 2);
+		return;
+	}
+
+	printf("Usage: monitor [stats [reset]]\n");
+	printf("       monitor stream [csv|binary]\n");
+	printf("       monitor energy [<channel> [reset]]\n");
+	printf("       monitor peaks [<channel> [reset]]\n");
+	printf("       monitor interval [<ms>]\n");
+	printf("       monitor windows [<s>,<s>,<s>]\n");
+	printf("       monitor config [<channel> [<param>=<val>[,...] ...]]\n\n");
+	printf("Valid channels are A..%c|0..%u|ALL\n", 'A' + num_ch - 1,
+	       num_ch - 1);
+	printf("Valid parameters are shunt=<mOhm>, imax=<mA>, adc=<9..12>b|<2..128>s, brng=<16|32>\n");
+}
+
+static void cmd_alarm(int argc, char *argv[])
+{
+	int ch;
+
+	if (!argc) {
+		alarm_show();
+		return;
+	}
+
+	if (!part_strncasecmp(argv[0], "clear", 1) && argc == 1) {
+		alarm_clear();
+		return;
+	}
+
+	if (part_strncasecmp(argv[0], "help", 1)) {
+		ch = decode_channel(argv[0], "power", NUM_POWER_CH);
+		if (ch < -1)
+			return;
+
+		alarm_config(ch, argc - 1, argv + 1);
+		return;
+	}
+
+	printf("Usage: alarm [clear | <channel> [<param>=<val>[,...] ...]]\n\n");
+	printf("Valid channels are A..%c|0..%u|ALL\n",
+	       'A' + NUM_POWER_CH - 1, NUM_POWER_CH - 1);
+	printf("Valid parameters are imax=<mA>, vmin=<mV>, pmax=<mW>, hold=<ms>\n");
+	printf("A zero threshold disables the alarm\n");
+}
+
+static void cmd_capture_usage(void)
+{
+	printf("Usage: capture [arm [<trigger>] [pre=<n>] [post=<n>] | trigger | dump [csv|binary]]\n\n");
+	printf("Valid triggers are MANUAL|POWER [<channel>]|ABOVE <channel> <mA>|BELOW <channel> <mA>\n");
+	printf("Valid power channels are A..%c|0..%u|ALL\n",
+	       'A' + NUM_POWER_CH - 1, NUM_POWER_CH - 1);
+	printf("Valid monitor channels are A..%c|0..%u|ALL\n",
+	       'A' + ina219_num_channels() - 1, ina219_num_channels() - 1);
+	printf("At most %u pre- and post-trigger samples can be captured\n",
+	       CAPTURE_MAX);
+}
+
+static void cmd_capture_arm(int argc, char *argv[])
+{
+	unsigned int pre = CAPTURE_MAX / 4, post = CAPTURE_MAX - pre;
+	enum capture_trig trig = CAPTURE_TRIG_MANUAL;
+	int i = 0, ch = -1, level_mA = 0;
+
+	if (i < argc && !part_strncasecmp(argv[i], "manual", 1)) {
+		i++;
+	} else if (i < argc && !part_strncasecmp(argv[i], "power", 1)) {
+		trig = CAPTURE_TRIG_POWER;
+		if (++i < argc && !strchr(argv[i], '=')) {
+			ch = decode_channel(argv[i++], "power", NUM_POWER_CH);
+			if (ch < -1)
+				return;
+		}
+	} else if (i < argc && (!part_strncasecmp(argv[i], "above", 1) ||
+				!part_strncasecmp(argv[i], "below", 1))) {
+		trig = tolower(argv[i][0]) == 'a' ? CAPTURE_TRIG_ABOVE
+						  : CAPTURE_TRIG_BELOW;
+		if (i + 2 >= argc) {
+			cmd_capture_usage();
+			return;
+		}
+		ch = decode_channel(argv[i + 1], "monitor",
+				    ina219_num_channels());
+		if (ch < -1)
+			return;
+		level_mA = strtol(argv[i + 2], NULL, 0);
+		i += 3;
+	}
+
+	for (; i < argc; i++) {
+		if (!strncmp(argv[i], "pre=", 4)) {
+			pre = strtoul(argv[i] + 4, NULL, 0);
+		} else if (!strncmp(argv[i], "post=", 5)) {
+			post = strtoul(argv[i] + 5, NULL, 0);
+		} else {
+			cmd_capture_usage();
+			return;
+		}
+	}
+
+	if (!capture_arm(trig, ch, level_mA * 1000, pre, post))
+		capture_show();
+}
+
+static void cmd_capture(int argc, char *argv[])
+{
+	if (!argc) {
+		capture_show();
+		return;
+	}
+
+	if (!part_strncasecmp(argv[0], "arm", 1)) {
+		cmd_capture_arm(argc - 1, argv + 1);
+		return;
+	}
+
+	if (!part_strncasecmp(argv[0], "trigger", 1) && argc == 1) {
+		capture_trigger();
+		capture_show();
+		return;
+	}
+
+	if (!part_strncasecmp(argv[0], "dump", 1) && argc <= 2) {
+		if (argc == 1 || !part_strncasecmp(argv[1], "csv", 1)) {
+			capture_dump(0);
+			return;
+		}
+
+		if (!part_strncasecmp(argv[1], "binary", 1)) {
+			capture_dump(1);
+			return;
+		}
+	}
+
+	cmd_capture_usage();
 }
 
 static void cmd_test(int argc, char *argv[])
@@ -164,6 +426,22 @@ static void cmd_test(int argc, char *argv[])
 	cmd_start(CMD_TEST, "test");
 }
 
+static void cmd_tasks(int argc, char *argv[])
+{
+	if (argc > 1 || (argc && part_strncasecmp(argv[0], "reset", 1))) {
+		printf("Usage: tasks [reset]\n");
+		return;
+	}
+
+	if (argc) {
+		task_reset_stats();
+		work_reset_stats();
+	} else {
+		task_show_stats();
+		work_show_stats();
+	}
+}
+
 static int decode_hex_char(char c)
 {
 	switch (c) {
@@ -254,9 +532,16 @@ found:
 	return;
 }
 
+static char power_cache[NUM_POWER_CH];
+
+/* A power channel was switched off behind our back, e.g. by an alarm */
+void cmd_power_cut(unsigned int ch)
+{
+	power_cache[ch] = 0;
+}
+
 static void cmd_power(int argc, char *argv[])
 {
-	static char cache[NUM_POWER_CH];
 	unsigned int i;
 	int ch, state;
 
@@ -274,7 +559,7 @@ static void cmd_power(int argc, char *argv[])
 
 	if (argc < 2) {
 		for_each_selected_channel(i, ch, NUM_POWER_CH)
-			printf("%d\n", cache[i]);
+			printf("%d\n", power_cache[i] && !alarm_tripped(i));
 		return;
 	}
 
@@ -286,14 +571,39 @@ static void cmd_power(int argc, char *argv[])
 		printf("Powering channel %c %s\n", 'A' + i,
 		       state ? "on" : "off");
 		digitalWrite(pin_power[i], state);
-		cache[i] = state;
+		alarm_power(i, state);
+		if (power_cache[i] != state)
+			capture_power(i, state);
+		power_cache[i] = state;
 	}
 }
 
 #define KEY_PULSE_MS	200
 
+static void pulse_end(unsigned long data)
+{
+	digitalWrite(data >> 1, data & 1);
+}
+
+/*
+ * Start a pulse on a pin, ended from a timer, so pulses on multiple channels
+ * run concurrently, and the bridges keep on running.
+ * Falls back to a blocking pulse if no timer is available.
+ */
+static void pulse_start(int *timer, uint8_t pin, int active)
+{
+	digitalWrite(pin, active);
+	*timer = task_timer_add(pulse_end, pin << 1 | !active,
+				KEY_PULSE_MS * 1000);
+	if (*timer < 0) {
+		delay(KEY_PULSE_MS);
+		digitalWrite(pin, !active);
+	}
+}
+
 static void cmd_key(int argc, char *argv[])
 {
+	static int pulse[NUM_KEY_CH];
 	static char cache[NUM_KEY_CH];
 	unsigned int i;
 	int ch, state;
@@ -321,6 +631,7 @@ static void cmd_key(int argc, char *argv[])
 		return;
 
 	for_each_selected_channel(i, ch, NUM_KEY_CH) {
+		task_timer_cancel(pulse[i]);
 		/* Keys are active-low! */
 		switch (state) {
 		case STATE_ON:
@@ -337,9 +648,7 @@ static void cmd_key(int argc, char *argv[])
 
 		case STATE_PULSE:
 			printf("Pulsing key %c\n", '0' + i);
-			digitalWrite(pin_key[i], 0);
-			delay(KEY_PULSE_MS);
-			digitalWrite(pin_key[i], 1);
+			pulse_start(&pulse[i], pin_key[i], 0);
 			cache[i] = 0;
 			break;
 		}
@@ -348,6 +657,7 @@ static void cmd_key(int argc, char *argv[])
 
 static void cmd_gpio(int argc, char *argv[])
 {
+	static int pulse[NUM_GPIO_CH];
 	static char cache[NUM_GPIO_CH];
 	unsigned int i;
 	int ch, state;
@@ -375,6 +685,7 @@ static void cmd_gpio(int argc, char *argv[])
 		return;
 
 	for_each_selected_channel(i, ch, NUM_GPIO_CH) {
+		task_timer_cancel(pulse[i]);
 		switch (state) {
 		case STATE_ON:
 			printf("Switching GPIO %c %s\n", '0' + i, "on");
@@ -390,26 +701,52 @@ static void cmd_gpio(int argc, char *argv[])
 
 		case STATE_PULSE:
 			printf("Pulsing GPIO %c\n", '0' + i);
-			digitalWrite(pin_gpio[i], 1);
-			delay(KEY_PULSE_MS);
-			digitalWrite(pin_gpio[i], 0);
+			pulse_start(&pulse[i], pin_gpio[i], 1);
 			cache[i] = 0;
 			break;
 		}
 	}
 }
 
-static void cmd_i2c_scan(void)
+static void cmd_latency(int argc, char *argv[])
 {
-	unsigned int i, n;
+	if (argc > 1 || (argc && part_strncasecmp(argv[0], "reset", 1))) {
+		printf("Usage: latency [reset]\n");
+		return;
+	}
+
+	if (argc)
+		task_reset_latency();
+	else
+		task_show_latency();
+}
+
+/*
+ * Scanning the bus takes a while, so it runs as a protothread, allowing the
+ * bridges to keep on running between the probes of two addresses.
+ */
+static struct pt i2c_scan_pt;
+static unsigned int i2c_scan_addr, i2c_scan_found;
+
+static int i2c_scan(void)
+{
+	struct pt *pt = &i2c_scan_pt;
 	int res;
 
-	for (i = I2C_ADDR_FIRST, n = 0; i <= I2C_ADDR_LAST; i++) {
-		res = twi_writeTo(i, NULL, 0, true, true);
+	PT_BEGIN(pt);
+
+	for (i2c_scan_addr = I2C_ADDR_FIRST, i2c_scan_found = 0;
+	     i2c_scan_addr <= I2C_ADDR_LAST; i2c_scan_addr++) {
+		/* Interrupted by CTRL-C? */
+		if (cmd_mode != CMD_BUSY)
+			PT_EXIT(pt);
+
+		res = twi_writeTo(i2c_scan_addr, NULL, 0, true, true);
 		switch (res) {
 		case 0:
-			printf("Found I2C device at address %#02x\n", i);
-			n++;
+			printf("Found I2C device at address %#02x\n",
+			       i2c_scan_addr);
+			i2c_scan_found++;
 			break;
 
 		case 2:	/* recv addr NACK */
@@ -417,12 +754,32 @@ static void cmd_i2c_scan(void)
 
 		default:
 			pr_err("I2C bus failure\n");
-			return;
+			cmd_done();
+			PT_EXIT(pt);
 		}
+
+		PT_YIELD(pt);
 	}
 
-	if (!n)
+	if (!i2c_scan_found)
 		printf("No I2C devices found\n");
+	cmd_done();
+
+	PT_END(pt);
+}
+
+static struct task task_i2c_scan = {
+	.name = "i2c scan",
+	.func = i2c_scan,
+	.period = 0,
+	.policy = TASK_RESCHEDULE,
+};
+
+static void cmd_i2c_scan(void)
+{
+	PT_INIT(&i2c_scan_pt);
+	cmd_mode = CMD_BUSY;
+	task_add(&task_i2c_scan);
 }
 
 static void cmd_i2c_get(int argc, char *argv[])
@@ -529,20 +886,68 @@ static void cmd_i2c(int argc, char *argv[])
 		printf("Unknown I2C command %s\n", argv[0]);
 }
 
+#ifdef INA219_SIM
+static void cmd_sim(int argc, char *argv[])
+{
+	unsigned long x;
+	char *end;
+
+	if (!argc) {
+		ina219_sim_config(-1, 0, NULL);
+		return;
+	}
+
+	if (!part_strncasecmp(argv[0], "stats", 1) && argc <= 2) {
+		if (argc == 1) {
+			ina219_sim_show_stats();
+			return;
+		}
+
+		if (!part_strncasecmp(argv[1], "reset", 1)) {
+			ina219_sim_reset_stats();
+			return;
+		}
+	}
+
+	if (!part_strncasecmp(argv[0], "bench", 1) && argc <= 2) {
+		ina219_sim_bench(argc > 1 ? strtoul(argv[1], NULL, 0) : 1000);
+		return;
+	}
+
+	x = strtoul(argv[0], &end, 0);
+	if (end != argv[0] && !*end) {
+		ina219_sim_config(x, argc - 1, argv + 1);
+		return;
+	}
+
+	printf("Usage: sim [stats [reset] | bench [<sets>] | <addr> [<param>=<val>[,...] ...]]\n\n");
+	printf("Valid parameters are wave=dc|square|ramp, vbus=<mV>, ilo=<mA>, ihi=<mA>,\n");
+	printf("period=<ms>, nack=<n>, short=<n>, ovf=0|1, present=0|1, foreign=0|1\n");
+}
+#endif
+
 static struct cmd commands[] = {
+	{ "Alarm", "Configure power alarms", cmd_alarm },
+	{ "Capture", "Capture power traces", cmd_capture },
 	{ "Getenv", "Get the value of an environment variable", cmd_getenv },
 	{ "GPio", "Control GPIO", cmd_gpio },
 	{ "Help", "Display this help", cmd_help },
 	{ "HIstory", "Show command history", cmd_history },
 	{ "I2c", "I2C tools", cmd_i2c },
 	{ "Key", "Control key", cmd_key },
+	{ "Latency", "Show task dispatch latency histogram", cmd_latency },
 	{ "Monitor", "Monitor power consumption", cmd_monitor },
 	{ "Power", "Control power", cmd_power },
 	{ "PRintenv", "Print all environment variables", cmd_printenv },
 	{ "RGB", "Show a color", cmd_rgb },
 	{ "Saveenv", "Save all environment variables", cmd_saveenv },
 	{ "SEtenv", "Set the value of an environment variable", cmd_setenv },
+#ifdef INA219_SIM
+	{ "SIm", "Control the INA219 simulator", cmd_sim },
+#endif
+	{ "STats", "Show CPU busy and idle time", cmd_stats },
 	{ "Test", "Test cycle through board features", cmd_test },
+	{ "TAsks", "Show task statistics", cmd_tasks },
 	{ "Version", "Display software version", cmd_version },
 	{ NULL, },
 };
@@ -552,6 +957,13 @@ void cmd_prompt(void)
 	printf("%s", env_get("prompt") ?: "");
 }
 
+/* Background command completed */
+void cmd_done(void)
+{
+	cmd_mode = CMD_COMMAND;
+	cmd_prompt();
+}
+
 void cmd_run(char *line)
 {
 	static char *argv[ARGV_MAX];
@@ -11,9 +11,22 @@ enum cmd_mode {
 	CMD_COMMAND,
 	CMD_MONITOR,
 	CMD_TEST,
+	CMD_STREAM,
+	CMD_BUSY,	/* Running a command in the background */
 };
 
 extern int cmd_mode;
 
+/*
+ * Can asynchronous messages be printed, without corrupting a stream or the
+ * output of a background command?
+ */
+static inline int cmd_may_print(void)
+{
+	return cmd_mode == CMD_COMMAND || cmd_mode == CMD_MONITOR;
+}
+
 extern void cmd_run(char *line);
 extern void cmd_prompt(void);
+extern void cmd_done(void);
+extern void cmd_power_cut(unsigned int ch);
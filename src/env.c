@@ -17,8 +17,29 @@ static struct env {
 	const char *val;
 } environment[] = {
 	{ "prompt", "BFF> " },
+	{ "alarmA", "" },
+	{ "alarmB", "" },
 	{ "baudA", "115200" },
 	{ "baudB", "115200" },
+	{ "i2cfreq", "400000" },
+	{ "ina219A", "shunt=100,imax=3200,adc=12b,brng=32" },
+	{ "ina219B", "shunt=100,imax=3200,adc=12b,brng=32" },
+	{ "ina219C", "shunt=100,imax=3200,adc=12b,brng=32" },
+	{ "ina219D", "shunt=100,imax=3200,adc=12b,brng=32" },
+	{ "ina219E", "shunt=100,imax=3200,adc=12b,brng=32" },
+	{ "ina219F", "shunt=100,imax=3200,adc=12b,brng=32" },
+	{ "ina219G", "shunt=100,imax=3200,adc=12b,brng=32" },
+	{ "ina219H", "shunt=100,imax=3200,adc=12b,brng=32" },
+	{ "ina219I", "shunt=100,imax=3200,adc=12b,brng=32" },
+	{ "ina219J", "shunt=100,imax=3200,adc=12b,brng=32" },
+	{ "ina219K", "shunt=100,imax=3200,adc=12b,brng=32" },
+	{ "ina219L", "shunt=100,imax=3200,adc=12b,brng=32" },
+	{ "ina219M", "shunt=100,imax=3200,adc=12b,brng=32" },
+	{ "ina219N", "shunt=100,imax=3200,adc=12b,brng=32" },
+	{ "ina219O", "shunt=100,imax=3200,adc=12b,brng=32" },
+	{ "ina219P", "shunt=100,imax=3200,adc=12b,brng=32" },
+	{ "moninterval", "1000" },
+	{ "monwindows", "60,300,900" },
 	/* sentinel */
 	{ NULL, NULL }
 };
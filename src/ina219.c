@@ -7,70 +7,170 @@
 // License, version 2.
 //
 
+#include <errno.h>
+#include <inttypes.h>
+#include <string.h>
 #include <twi.h>
 
+#include "cmd.h"
 #include "ina219.h"
+#include "ina219reg.h"
 #include "util.h"
 #include "print.h"
+#include "task.h"
 
-// INA219 I2C address base
-#define INA219_BASE		      0x40 // Up to 4 devices */
-
-#define INA219_CFG		      0x00 // Configuration
-#define INA219_SHUNT_V		      0x01 // Shunt Voltage
-#define INA219_BUS_V		      0x02 // Bus Voltage
-#define INA219_POWER		      0x03 // Power
-#define INA219_CURRENT		      0x04 // Current
-#define INA219_CALIB		      0x05 // Calibration
-
-// INA219 Config Register Bit Definitions
-#define INA219_CFG_RST		   BIT(15) // Reset
-#define INA219_CFG_BRNG		   BIT(13) // Bus Voltage Range
-#define INA219_CFG_BRNG_16V		 0 // 16V
-#define INA219_CFG_BRNG_32V	   BIT(13) // 32V
-#define INA219_CFG_GAIN_MASK	 (3 << 11) // PGA Gain and Range
-#define INA219_CFG_GAIN_1	 (0 << 11) // ±40 mV
-#define INA219_CFG_GAIN_2	 (1 << 11) // ±80 mV
-#define INA219_CFG_GAIN_4	 (2 << 11) // ±160 mV
-#define INA219_CFG_GAIN_8	 (3 << 11) // ±320 mV
-#define INA219_CFG_BADC_MASK	    0x0780 // Bus ADC Resolution/Averaging
-#define INA219_CFG_BADC_SHIFT		 7
-#define INA219_CFG_SADC_MASK	    0x0078 // Shunt ADC Resolution/Averaging
-#define INA219_CFG_SADC_SHIFT		 3
-
-#define INA219_CFG_xADC_9B		 0 // 9 bit
-#define INA219_CFG_xADC_10B		 1 // 10 bit
-#define INA219_CFG_xADC_11B		 2 // 11 bit
-#define INA219_CFG_xADC_12B		 3 // 12 bit
-#define INA219_CFG_xADC_2S		 9 // 2 samples
-#define INA219_CFG_xADC_4S		10 // 4 samples
-#define INA219_CFG_xADC_8S		11 // 8 samples
-#define INA219_CFG_xADC_16S		12 // 16 samples
-#define INA219_CFG_xADC_32S		13 // 32 samples
-#define INA219_CFG_xADC_64S		14 // 64 samples
-#define INA219_CFG_xADC_128S		15 // 128 samples
-
-#define INA219_CFG_MODE_MASK	    0x0007 // Operating Mode
-#define INA219_CFG_MODE_POWER_DOWN	 0 // Power-Down
-#define INA219_CFG_MODE_SHUNT_TRG	 1 // Shunt voltage, triggered
-#define INA219_CFG_MODE_BUS_TRG		 2 // Bus voltage, triggered
-#define INA219_CFG_MODE_SHUNT_BUS_TRG	 3 // Shunt and bus voltage, triggered
-#define INA219_CFG_MODE_ADC_OFF		 4 // ADC off (disabled)
-#define INA219_CFG_MODE_SHUNT_CNT	 5 // Shunt voltage, continuous
-#define INA219_CFG_MODE_BUS_CNT		 6 // Bus voltage, continuous
-#define INA219_CFG_MODE_SHUNT_BUS_CNT	 7 // Shunt and bus voltage, continuous
-
-// INA219 Bus Voltage Register Bit Definitions
-#define INA219_BUS_V_CNVR	     BIT(1) // Conversion Ready
-#define INA219_BUS_V_OVF	     BIT(0) // Math Overflow Flag
-
-
-static uint16_t ina219_config;
+#define INA219_MAX_SHUNT_MOHM	    100000
+// The shunt voltage range is at most twice the maximum shunt voltage, or
+// 40 mV, i.e. 40 A at 1 mOhm.  So the measurable current stays below 64 A,
+// and the power below INT32_MAX µW, even at 32.76 V
+#define INA219_MAX_CURRENT_MA	    32000
+
+// Register pointer value if unknown
+#define INA219_POINTER_UNKNOWN		0xff
+
+static struct ina219 {
+	struct ina219_params params;
+	uint16_t config;	// Configuration Register value
+	uint16_t calib;		// Calibration Register value
+	unsigned int current_lsb_uA;
+	uint8_t pointer;	// Register pointer, to avoid rewriting it
+	uint8_t addr;		// I2C address
+} ina219_dev[INA219_MAX];
+
+static unsigned int ina219_num;
 
 // Defaults for the Adafruit INA219 Current Sensor Breakout
-static const unsigned int ina219_calib = 4096;
-static const unsigned int ina219_current_div_mA = 10;
-static const unsigned int ina219_power_mult_mW = 2;
+const struct ina219_params ina219_default_params = {
+	.shunt_mohm = 100,
+	.max_mA = 3200,
+	.adc_bits = 12,
+	.adc_samples = 1,
+	.brng_V = 32,
+};
+
+// Conversion time per Bus/Shunt ADC Resolution/Averaging setting (µs)
+static const uint32_t ina219_adc_us[16] = {
+	84, 148, 276, 532, 84, 148, 276, 532,
+	532, 1060, 2130, 4260, 8510, 17020, 34050, 68100
+};
+
+// Result registers, in read order: the Bus Voltage Register must be read
+// before the Power Register, as the latter clears CNVR
+static const uint8_t ina219_regs_all[] = {
+	INA219_SHUNT_V, INA219_BUS_V, INA219_CURRENT, INA219_POWER
+};
+
+/*
+ * Errors are counted per channel, and reported by a low priority task, at
+ * most once per INA219_REPORT_PERIOD, so a flaky bus doesn't turn every
+ * sample into a burst of output.
+ */
+#define INA219_REPORT_PERIOD	(5 * HZ)
+
+enum ina219_error {
+	INA219_ERR_NACK,	// Address or data not acknowledged
+	INA219_ERR_SHORT,	// Short read
+	INA219_ERR_OVF,		// Math Overflow Flag set
+	INA219_ERR_OTHER,	// Timeout, arbitration lost, ...
+	INA219_ERR_NUM
+};
+
+static const char *const ina219_error_names[INA219_ERR_NUM] = {
+	[INA219_ERR_NACK] = "NACK",
+	[INA219_ERR_SHORT] = "short read",
+	[INA219_ERR_OVF] = "overflow",
+	[INA219_ERR_OTHER] = "other",
+};
+
+static struct ina219_errors {
+	unsigned int count[INA219_ERR_NUM];
+	unsigned int reported;	// Total count at the last report
+	enum ina219_error last;	// Last error
+	int last_code;		// Error code or length of the last error
+	uint32_t last_ms;	// Time of the last error
+} ina219_errors[INA219_MAX];
+
+// Count an error, may be called from interrupt context
+static void ina219_error(unsigned int ch, enum ina219_error err, int code)
+{
+	struct ina219_errors *e = &ina219_errors[ch];
+
+	e->count[err]++;
+	e->last = err;
+	e->last_code = code;
+	e->last_ms = millis();
+}
+
+// Classify an I2C transfer error: a twi_writeTo() status, or a negative
+// error code of a register read (-EIO for a short read, -ETIMEDOUT, or a
+// negated i2c_status)
+static void ina219_xfer_error(unsigned int ch, int code)
+{
+	switch (code) {
+	case 2:	/* Address NACK */
+	case 3:	/* Data NACK */
+	case -2:
+	case -3:
+		ina219_error(ch, INA219_ERR_NACK, code);
+		break;
+	case -EIO:
+		ina219_error(ch, INA219_ERR_SHORT, code);
+		break;
+	default:
+		ina219_error(ch, INA219_ERR_OTHER, code);
+		break;
+	}
+}
+
+static unsigned int ina219_error_total(const struct ina219_errors *e)
+{
+	unsigned int i, n = 0;
+
+	for (i = 0; i < INA219_ERR_NUM; i++)
+		n += e->count[i];
+
+	return n;
+}
+
+static int ina219_report(void)
+{
+	struct ina219_errors *e;
+	unsigned int ch, n;
+
+	// Don't corrupt a stream or binary output, report later
+	if (!cmd_may_print())
+		return 0;
+
+	for (ch = 0; ch < ina219_num; ch++) {
+		e = &ina219_errors[ch];
+		n = ina219_error_total(e);
+		if (n == e->reported)
+			continue;
+
+		pr_err("INA219-%u: %u new errors (%u NACK, %u short read, %u overflow, %u other), last %s (%d) at %" PRIu32 " ms\n",
+		       ch, n - e->reported, e->count[INA219_ERR_NACK],
+		       e->count[INA219_ERR_SHORT], e->count[INA219_ERR_OVF],
+		       e->count[INA219_ERR_OTHER], ina219_error_names[e->last],
+		       e->last_code, e->last_ms);
+		e->reported = n;
+	}
+
+	return 0;
+}
+
+static struct task task_ina219_report = {
+	.name = "ina219 report",
+	.func = ina219_report,
+	.period = INA219_REPORT_PERIOD,
+	.policy = TASK_SKIP_MISSED,
+};
+
+static struct {
+	unsigned int ch;
+	struct ina219_raw *raw;
+	void (*done)(unsigned int ch, int error);
+	uint8_t buf[4];
+} ina219_async;
 
 
 static int ina219_write(unsigned int ch, uint8_t reg, uint16_t val)
@@ -81,10 +181,11 @@ static int ina219_write(unsigned int ch, uint8_t reg, uint16_t val)
 	buf[0] = reg;
 	buf[1] = val >> 8;
 	buf[2] = val;
-	res = twi_writeTo(INA219_BASE + ch, buf, sizeof(buf), true, true);
+	res = twi_writeTo(ina219_dev[ch].addr, buf, sizeof(buf), true, true);
 	pr_debug("twi_writeTo() returned %u\n", res);
 	if (res)
-		pr_err("%s: twi_writeTo() returned error %d\n", __func__, res);
+		ina219_xfer_error(ch, res);
+	ina219_dev[ch].pointer = res ? INA219_POINTER_UNKNOWN : reg;
 
 	return -res;
 }
@@ -94,28 +195,94 @@ static int ina219_read(unsigned int ch, uint8_t reg)
 	uint8_t buf[2];
 	int res;
 
-	res = twi_writeTo(INA219_BASE + ch, &reg, 1, true, false);
-	pr_debug("twi_writeTo() returned %u\n", res);
-	if (res) {
-		pr_err("%s: twi_writeTo() returned error %d\n", __func__, res);
-		return -res;
+	// A pending non-blocking read may still move the register pointer
+	twi_asyncWait();
+
+	// The register pointer is retained, so repeated reads of the same
+	// register don't need to rewrite it
+	if (ina219_dev[ch].pointer != reg) {
+		ina219_dev[ch].pointer = INA219_POINTER_UNKNOWN;
+		res = twi_writeTo(ina219_dev[ch].addr, &reg, 1, true, false);
+		pr_debug("twi_writeTo() returned %u\n", res);
+		if (res) {
+			ina219_xfer_error(ch, res);
+			return -res;
+		}
+		ina219_dev[ch].pointer = reg;
 	}
 
-	res = twi_readFrom(INA219_BASE + ch, buf, sizeof(buf), true);
+	res = twi_readFrom(ina219_dev[ch].addr, buf, sizeof(buf), true);
 	pr_debug("twi_readFrom() returned %u\n", res);
 	if (res != sizeof(buf)) {
-		pr_err("%s: twi_readFrom() read only %d bytes\n", __func__,
-		       res);
-		return -1;
+		// Nothing is read if the address is not acknowledged
+		ina219_error(ch, res ? INA219_ERR_SHORT : INA219_ERR_NACK,
+			     res);
+		ina219_dev[ch].pointer = INA219_POINTER_UNKNOWN;
+		return -EIO;
 	}
 
 	return buf[0] << 8 | buf[1];
 }
 
-static void ina219_dump_config(uint16_t cfg)
+// Conversion time for a Configuration Register value
+uint32_t ina219_config_us(uint16_t cfg)
+{
+	uint32_t bus_us = ina219_adc_us[(cfg & INA219_CFG_BADC_MASK) >>
+					INA219_CFG_BADC_SHIFT];
+	uint32_t shunt_us = ina219_adc_us[(cfg & INA219_CFG_SADC_MASK) >>
+					  INA219_CFG_SADC_SHIFT];
+
+	switch (cfg & INA219_CFG_MODE_MASK) {
+	case INA219_CFG_MODE_SHUNT_TRG:
+	case INA219_CFG_MODE_SHUNT_CNT:
+		return shunt_us;
+
+	case INA219_CFG_MODE_BUS_TRG:
+	case INA219_CFG_MODE_BUS_CNT:
+		return bus_us;
+
+	default:
+		return shunt_us + bus_us;
+	}
+}
+
+static void ina219_decode_adc(unsigned int adc, unsigned int *bits,
+			      unsigned int *samples)
+{
+	if (adc < INA219_CFG_xADC_1S) {
+		*bits = 9 + (adc & 3);
+		*samples = 1;
+	} else {
+		*bits = 12;
+		*samples = 1 << (adc - INA219_CFG_xADC_1S);
+	}
+}
+
+static int ina219_encode_adc(unsigned int bits, unsigned int samples)
 {
-	uint8_t brng = 0, gain = 0, bus_bits = 0, shunt_bits = 0;
-	const char *mode;
+	unsigned int adc;
+
+	if (samples > 1) {
+		for (adc = INA219_CFG_xADC_2S; adc <= INA219_CFG_xADC_128S;
+		     adc++)
+			if (samples == 1U << (adc - INA219_CFG_xADC_1S))
+				return adc;
+		return -1;
+	}
+
+	if (bits < 9 || bits > 12)
+		return -1;
+
+	return INA219_CFG_xADC_9B + bits - 9;
+}
+
+void ina219_dump_config(unsigned int ch)
+{
+	const struct ina219 *dev = &ina219_dev[ch];
+	unsigned int bus_bits, bus_samples, shunt_bits, shunt_samples;
+	uint8_t brng = 0, gain = 0;
+	uint16_t cfg = dev->config;
+	const char *mode = "Unknown";
 
 	switch (cfg & INA219_CFG_BRNG) {
 	case INA219_CFG_BRNG_16V:
@@ -146,41 +313,10 @@ static void ina219_dump_config(uint16_t cfg)
 
 	}
 
-	switch ((cfg & INA219_CFG_BADC_MASK) >> INA219_CFG_BADC_SHIFT) {
-	case INA219_CFG_xADC_9B:
-		bus_bits = 9;
-		break;
-
-	case INA219_CFG_xADC_10B:
-		bus_bits = 10;
-		break;
-
-	case INA219_CFG_xADC_11B:
-		bus_bits = 11;
-		break;
-
-	case INA219_CFG_xADC_12B:
-		bus_bits = 12;
-		break;
-	}
-
-	switch ((cfg & INA219_CFG_SADC_MASK) >> INA219_CFG_SADC_SHIFT) {
-	case INA219_CFG_xADC_9B:
-		shunt_bits = 9;
-		break;
-
-	case INA219_CFG_xADC_10B:
-		shunt_bits = 10;
-		break;
-
-	case INA219_CFG_xADC_11B:
-		shunt_bits = 11;
-		break;
-
-	case INA219_CFG_xADC_12B:
-		shunt_bits = 12;
-		break;
-	}
+	ina219_decode_adc((cfg & INA219_CFG_BADC_MASK) >> INA219_CFG_BADC_SHIFT,
+			  &bus_bits, &bus_samples);
+	ina219_decode_adc((cfg & INA219_CFG_SADC_MASK) >> INA219_CFG_SADC_SHIFT,
+			  &shunt_bits, &shunt_samples);
 
 	switch ((cfg & INA219_CFG_MODE_MASK)) {
 	case INA219_CFG_MODE_POWER_DOWN:
@@ -209,15 +345,170 @@ static void ina219_dump_config(uint16_t cfg)
 		break;
 	}
 
+	pr_info("INA219-%u\n", ch);
 	pr_info("INA219_CFG           = %#x\n", cfg);
 	pr_info("Bus Voltage Range    = %2u\n", brng);
 	pr_info("Shunt Voltage Gain   = %2u\n", gain);
-	pr_info("Bus ADC resolution   = %2u\n", bus_bits);
-	pr_info("Shunt ADC resolution = %2u\n", shunt_bits);
+	pr_info("Bus ADC resolution   = %2u (%u samples)\n", bus_bits,
+		bus_samples);
+	pr_info("Shunt ADC resolution = %2u (%u samples)\n", shunt_bits,
+		shunt_samples);
 	pr_info("Operating mode       = %s\n", mode);
+	pr_info("Conversion time      = %" PRIu32 " us\n", ina219_config_us(cfg));
+	pr_info("Shunt resistance     = %u mOhm\n", dev->params.shunt_mohm);
+	pr_info("Maximum current      = %u mA\n", dev->params.max_mA);
+	pr_info("INA219_CALIB         = %u\n", dev->calib);
+	pr_info("Current LSB          = %u uA\n", dev->current_lsb_uA);
+}
+
+// Time needed to complete a full conversion cycle (µs)
+uint32_t ina219_conversion_us(unsigned int ch)
+{
+	return ina219_config_us(ina219_dev[ch].config);
+}
+
+/*
+ * Program the configuration and calibration for the given shunt resistor,
+ * maximum expected current, bus voltage range, and ADC resolution or
+ * averaging, which is used for both the bus and shunt voltages.
+ */
+int ina219_configure(unsigned int ch, const struct ina219_params *params)
+{
+	struct ina219 *dev = &ina219_dev[ch];
+	unsigned int lsb_uA, calib;
+	uint64_t max_uV;
+	uint16_t config;
+	int adc, res;
+
+	// The maximum shunt voltage must fit in the largest (320 mV) range
+	adc = ina219_encode_adc(params->adc_bits, params->adc_samples);
+	max_uV = (uint64_t)params->max_mA * params->shunt_mohm;
+	if (adc < 0 || !params->shunt_mohm || !params->max_mA ||
+	    params->shunt_mohm > INA219_MAX_SHUNT_MOHM ||
+	    params->max_mA > INA219_MAX_CURRENT_MA || max_uV > 320000 ||
+	    (params->brng_V != 16 && params->brng_V != 32))
+		goto invalid;
+
+	// Use the smallest shunt voltage range that fits
+	if (max_uV <= 40000)
+		config = INA219_CFG_GAIN_1;
+	else if (max_uV <= 80000)
+		config = INA219_CFG_GAIN_2;
+	else if (max_uV <= 160000)
+		config = INA219_CFG_GAIN_4;
+	else
+		config = INA219_CFG_GAIN_8;
+
+	config |= params->brng_V == 32 ? INA219_CFG_BRNG_32V
+				       : INA219_CFG_BRNG_16V;
+	config |= adc << INA219_CFG_BADC_SHIFT | adc << INA219_CFG_SADC_SHIFT;
+	config |= INA219_CFG_MODE_SHUNT_BUS_CNT;
+
+	// Current_LSB = Maximum Expected Current / 2^15
+	// Cal = trunc(0.04096 / (Current_LSB * R_SHUNT))
+	lsb_uA = (params->max_mA * 1000 + 32767) / 32768;
+	while ((calib = 40960000 / (lsb_uA * params->shunt_mohm)) > 0xfffe)
+		lsb_uA++;
+	calib &= ~1;	// Bit 0 is not used
+	if (!calib)
+		goto invalid;
+
+	res = ina219_write(ch, INA219_CFG, config);
+	if (res)
+		return res;
+
+	res = ina219_write(ch, INA219_CALIB, calib);
+	if (res)
+		return res;
+
+	dev->params = *params;
+	dev->config = config;
+	dev->calib = calib;
+	dev->current_lsb_uA = lsb_uA;
+
+	ina219_dump_config(ch);
+	return 0;
+
+invalid:
+	pr_err("INA219-%u: Invalid parameters\n", ch);
+	return -1;
+}
+
+void ina219_get_params(unsigned int ch, struct ina219_params *params)
+{
+	*params = ina219_dev[ch].params;
+}
+
+// Read a register of a device that is not bound to a channel
+static int ina219_probe_read(uint8_t addr, uint8_t reg)
+{
+	uint8_t buf[2];
+
+	if (twi_writeTo(addr, &reg, 1, true, false) ||
+	    twi_readFrom(addr, buf, sizeof(buf), true) != sizeof(buf))
+		return -1;
+
+	return buf[0] << 8 | buf[1];
+}
+
+// Check that a device looks like an INA219, as other devices may share the
+// address range: reserved bits must read as zero, and the configuration
+// cannot be in reset (0x399f after power-on reset)
+static int ina219_identify(uint8_t addr)
+{
+	int cfg, bus;
+
+	cfg = ina219_probe_read(addr, INA219_CFG);
+	if (cfg < 0 || (cfg & (INA219_CFG_RST | INA219_CFG_RESERVED)))
+		return 0;
+
+	bus = ina219_probe_read(addr, INA219_BUS_V);
+	return bus >= 0 && !(bus & INA219_BUS_V_RESERVED);
+}
+
+/*
+ * Scan the I2C bus for INA219s, and assign channel numbers.  The first
+ * fixed channels are always bound to the first addresses, so they keep
+ * their numbers even if a device is missing.  Devices at the remaining
+ * addresses get the next channel numbers, in address order, if they can be
+ * identified as INA219s.
+ * Also starts the reporting of errors.
+ * Returns the number of channels.
+ */
+unsigned int ina219_probe(unsigned int fixed)
+{
+	unsigned int ch;
+	uint8_t addr;
+
+	for (ch = 0; ch < fixed; ch++)
+		ina219_dev[ch].addr = INA219_BASE + ch;
+
+	for (addr = INA219_BASE + fixed; addr < INA219_BASE + INA219_MAX;
+	     addr++) {
+		if (twi_writeTo(addr, NULL, 0, true, true))
+			continue;
+
+		if (!ina219_identify(addr)) {
+			pr_warn("Ignoring non-INA219 device at address %#x\n",
+				addr);
+			continue;
+		}
+
+		pr_info("INA219-%u: Found at address %#x\n", ch, addr);
+		ina219_dev[ch++].addr = addr;
+	}
+
+	ina219_num = ch;
+	task_add(&task_ina219_report);
+	return ch;
+}
+
+unsigned int ina219_num_channels(void)
+{
+	return ina219_num;
 }
 
-int ina219_init(unsigned int ch)
+int ina219_init(unsigned int ch, const struct ina219_params *params)
 {
 	int x;
 
@@ -246,88 +537,147 @@ int ina219_init(unsigned int ch)
 	// voltage.  The Current register and Power register are only available
 	// if the Calibration register contains a programmed value.
 
+	ina219_dev[ch].pointer = INA219_POINTER_UNKNOWN;
 	x = ina219_read(ch, INA219_CFG);
 	if (x < 0)
 		return x;
 
-	if (!ch) {
-		ina219_config = x;
-		ina219_dump_config(x);
-	} else if (x != ina219_config) {
-		pr_err("INA219_CFG mismatch: ch0 %#x ch1 %#x\n",
-		       ina219_config, x);
-		ina219_dump_config(x);
-	}
+	pr_debug("INA219_CFG           = %#04x (OLD)\n", x);
 
-	x = ina219_read(ch, INA219_CALIB);
-	if (x < 0)
-		return x;
+	return ina219_configure(ch, params);
+}
 
-	pr_debug("INA219_CALIB         = %#04x/%u\n", x, x);
+void ina219_show_stats(void)
+{
+	const struct ina219_errors *e;
+	unsigned int ch, i;
+
+	printf("Ch  Addr");
+	for (i = 0; i < INA219_ERR_NUM; i++)
+		printf("  %10s", ina219_error_names[i]);
+	printf("  Last error\n");
+
+	for (ch = 0; ch < ina219_num; ch++) {
+		e = &ina219_errors[ch];
+		printf("%c   %#x", 'A' + ch, ina219_dev[ch].addr);
+		for (i = 0; i < INA219_ERR_NUM; i++)
+			printf("  %10u", e->count[i]);
+		if (ina219_error_total(e))
+			printf("  %s (%d) at %" PRIu32 " ms\n",
+			       ina219_error_names[e->last], e->last_code,
+			       e->last_ms);
+		else
+			printf("  -\n");
+	}
+}
 
-	ina219_write(ch, INA219_CALIB, ina219_calib);
+void ina219_reset_stats(void)
+{
+	memset(ina219_errors, 0, sizeof(ina219_errors));
+}
 
-	x = ina219_read(ch, INA219_CALIB);
-	if (x < 0)
-		return x;
+static inline uint16_t ina219_get_reg(const uint8_t *buf, unsigned int i)
+{
+	return buf[2 * i] << 8 | buf[2 * i + 1];
+}
 
-	pr_debug("INA219_CALIB         = %#04x/%u (NEW)\n", x, x);
+// Read all result registers in a single I2C transaction
+int ina219_read_all(unsigned int ch, struct ina219_raw *raw)
+{
+	uint8_t buf[2 * ARRAY_SIZE(ina219_regs_all)];
+	int res;
+
+	ina219_dev[ch].pointer = INA219_POINTER_UNKNOWN;
+	res = twi_readRegisters(ina219_dev[ch].addr, ina219_regs_all,
+				ARRAY_SIZE(ina219_regs_all), buf, 2);
+	if (res < 0) {
+		ina219_xfer_error(ch, res);
+		return res;
+	}
+	if (res != sizeof(buf)) {
+		ina219_error(ch, INA219_ERR_SHORT, res);
+		return -EIO;
+	}
 
+	raw->shunt = ina219_get_reg(buf, 0);
+	raw->bus = ina219_get_reg(buf, 1);
+	raw->current = ina219_get_reg(buf, 2);
+	raw->power = ina219_get_reg(buf, 3);
+	ina219_dev[ch].pointer = INA219_POWER;
 	return 0;
 }
 
-int ina219_get_shunt_uV(unsigned int ch)
+static void ina219_async_done(int res)
 {
-	int x = ina219_read(ch, INA219_SHUNT_V);
-	pr_debug("INA219_SHUNT_V = %#04x\n", x);
-	if (x < 0)
-		return x;
+	unsigned int ch = ina219_async.ch;
 
-	// Shunt voltage is signed, ignore negative values
-	if ((int16_t)x < 0)
-		return 0;
+	if (res < 0) {
+		ina219_xfer_error(ch, res);
+		ina219_async.done(ch, res);
+		return;
+	}
+	if (res != sizeof(ina219_async.buf)) {
+		ina219_error(ch, INA219_ERR_SHORT, res);
+		ina219_async.done(ch, -EIO);
+		return;
+	}
 
-	return x * 10;
+	ina219_async.raw->shunt = ina219_get_reg(ina219_async.buf, 0);
+	ina219_async.raw->bus = ina219_get_reg(ina219_async.buf, 1);
+	if (ina219_async.raw->bus & INA219_BUS_V_OVF)
+		ina219_error(ch, INA219_ERR_OVF, 0);
+	ina219_dev[ch].pointer = INA219_BUS_V;
+	ina219_async.done(ch, 0);
 }
 
-int ina219_get_bus_mV(unsigned int ch)
+// Start reading the shunt and bus voltage registers, without blocking.
+// On completion, done() is called from interrupt context.
+int ina219_read_async(unsigned int ch, struct ina219_raw *raw,
+		      void (*done)(unsigned int ch, int error))
 {
-	int x;
+	// Don't clobber the state of a pending read
+	if (twi_asyncBusy())
+		return -1;
 
-	do {
-		x = ina219_read(ch, INA219_BUS_V);
-		pr_debug("INA219_BUS_V   = %#04x\n", x);
-		if (x < 0)
-			return x;
-	} while (!(x & INA219_BUS_V_CNVR));
+	ina219_async.ch = ch;
+	ina219_async.raw = raw;
+	ina219_async.done = done;
+	ina219_dev[ch].pointer = INA219_POINTER_UNKNOWN;
 
-	if (x & INA219_BUS_V_OVF) {
-		pr_err("INA219 Math Overflow!\n");
-	}
+	// Shunt and Bus Voltage Registers only
+	return twi_readRegistersAsync(ina219_dev[ch].addr, ina219_regs_all, 2,
+				      ina219_async.buf, 2, ina219_async_done);
+}
 
-	return 4 * (x >> 3);
+int ina219_shunt_uV(unsigned int ch, const struct ina219_raw *raw)
+{
+	return raw->shunt * 10;
 }
 
-int ina219_get_power_mW(unsigned int ch)
+int ina219_bus_mV(unsigned int ch, const struct ina219_raw *raw)
 {
-	int x = ina219_read(ch, INA219_POWER);
-	pr_debug("INA219_POWER   = %#04x\n", x);
-	if (x < 0)
-		return x;
+	return 4 * (raw->bus >> 3);
+}
 
-	return x * ina219_power_mult_mW;
+// Current and power are calculated like the INA219 does internally, but
+// without the rounding to the Current and Power Register LSBs
+static int ina219_current_raw(unsigned int ch, const struct ina219_raw *raw)
+{
+	return raw->shunt * ina219_dev[ch].calib / 4096;
 }
 
-int ina219_get_current_mA(unsigned int ch)
+int ina219_current_uA(unsigned int ch, const struct ina219_raw *raw)
 {
-	int x = ina219_read(ch, INA219_CURRENT);
-	pr_debug("INA219_CURRENT = %#04x\n", x);
-	if (x < 0)
-		return x;
+	int lsb_uA = ina219_dev[ch].current_lsb_uA;
 
-	// Current is signed, ignore negative values
-	if ((int16_t)x < 0)
-		return 0;
+	return ina219_current_raw(ch, raw) * lsb_uA;
+}
 
-	return DIV_ROUND_CLOSEST(x, ina219_current_div_mA);
+int ina219_power_uW(unsigned int ch, const struct ina219_raw *raw)
+{
+	// Power Register = Current Register * Bus Voltage Register / 5000,
+	// Power_LSB = 20 * Current_LSB
+	// Negative when current flows back into the supply
+	return (int64_t)ina219_current_raw(ch, raw) * (raw->bus >> 3) *
+	       ina219_dev[ch].current_lsb_uA / 250;
 }
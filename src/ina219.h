@@ -9,8 +9,41 @@
 
 #include <stdint.h>
 
-extern int ina219_init(unsigned int ch);
-extern int ina219_get_shunt_uV(unsigned int ch);
-extern int ina219_get_bus_mV(unsigned int ch);
-extern int ina219_get_power_mW(unsigned int ch);
-extern int ina219_get_current_mA(unsigned int ch);
+#define INA219_MAX		16	/* Addresses 0x40-0x4f */
+
+struct ina219_raw {
+	int16_t shunt;		// Shunt Voltage Register
+	uint16_t bus;		// Bus Voltage Register
+	int16_t current;	// Current Register
+	uint16_t power;		// Power Register
+};
+
+struct ina219_params {
+	unsigned int shunt_mohm;	// Shunt resistance (mΩ)
+	unsigned int max_mA;		// Maximum expected current (mA)
+	unsigned int adc_bits;		// ADC resolution (9-12 bits)
+	unsigned int adc_samples;	// Samples averaged (1-128, at 12 bits)
+	unsigned int brng_V;		// Bus voltage range (16 or 32 V)
+};
+
+extern const struct ina219_params ina219_default_params;
+
+extern unsigned int ina219_probe(unsigned int fixed);
+extern unsigned int ina219_num_channels(void);
+extern int ina219_init(unsigned int ch, const struct ina219_params *params);
+extern int ina219_configure(unsigned int ch,
+			    const struct ina219_params *params);
+extern void ina219_get_params(unsigned int ch, struct ina219_params *params);
+extern void ina219_dump_config(unsigned int ch);
+extern uint32_t ina219_config_us(uint16_t cfg);
+extern uint32_t ina219_conversion_us(unsigned int ch);
+extern void ina219_show_stats(void);
+extern void ina219_reset_stats(void);
+
+extern int ina219_read_all(unsigned int ch, struct ina219_raw *raw);
+extern int ina219_read_async(unsigned int ch, struct ina219_raw *raw,
+			     void (*done)(unsigned int ch, int error));
+extern int ina219_shunt_uV(unsigned int ch, const struct ina219_raw *raw);
+extern int ina219_bus_mV(unsigned int ch, const struct ina219_raw *raw);
+extern int ina219_current_uA(unsigned int ch, const struct ina219_raw *raw);
+extern int ina219_power_uW(unsigned int ch, const struct ina219_raw *raw);
@@ -0,0 +1,62 @@
+//
+// INA219 Register Definitions
+//
+// © Copyright 2019-2020 Glider bv
+//
+// This file is subject to the terms and conditions of the GNU General Public
+// License, version 2.
+//
+
+// INA219 I2C address base, up to INA219_MAX devices
+#define INA219_BASE		      0x40
+
+#define INA219_CFG		      0x00 // Configuration
+#define INA219_SHUNT_V		      0x01 // Shunt Voltage
+#define INA219_BUS_V		      0x02 // Bus Voltage
+#define INA219_POWER		      0x03 // Power
+#define INA219_CURRENT		      0x04 // Current
+#define INA219_CALIB		      0x05 // Calibration
+
+// INA219 Config Register Bit Definitions
+#define INA219_CFG_RST		   BIT(15) // Reset
+#define INA219_CFG_RESERVED	   BIT(14) // Reserved, reads as zero
+#define INA219_CFG_BRNG		   BIT(13) // Bus Voltage Range
+#define INA219_CFG_BRNG_16V		 0 // 16V
+#define INA219_CFG_BRNG_32V	   BIT(13) // 32V
+#define INA219_CFG_GAIN_MASK	 (3 << 11) // PGA Gain and Range
+#define INA219_CFG_GAIN_1	 (0 << 11) // ±40 mV
+#define INA219_CFG_GAIN_2	 (1 << 11) // ±80 mV
+#define INA219_CFG_GAIN_4	 (2 << 11) // ±160 mV
+#define INA219_CFG_GAIN_8	 (3 << 11) // ±320 mV
+#define INA219_CFG_BADC_MASK	    0x0780 // Bus ADC Resolution/Averaging
+#define INA219_CFG_BADC_SHIFT		 7
+#define INA219_CFG_SADC_MASK	    0x0078 // Shunt ADC Resolution/Averaging
+#define INA219_CFG_SADC_SHIFT		 3
+
+#define INA219_CFG_xADC_9B		 0 // 9 bit
+#define INA219_CFG_xADC_10B		 1 // 10 bit
+#define INA219_CFG_xADC_11B		 2 // 11 bit
+#define INA219_CFG_xADC_12B		 3 // 12 bit
+#define INA219_CFG_xADC_1S		 8 // 12 bit
+#define INA219_CFG_xADC_2S		 9 // 2 samples
+#define INA219_CFG_xADC_4S		10 // 4 samples
+#define INA219_CFG_xADC_8S		11 // 8 samples
+#define INA219_CFG_xADC_16S		12 // 16 samples
+#define INA219_CFG_xADC_32S		13 // 32 samples
+#define INA219_CFG_xADC_64S		14 // 64 samples
+#define INA219_CFG_xADC_128S		15 // 128 samples
+
+#define INA219_CFG_MODE_MASK	    0x0007 // Operating Mode
+#define INA219_CFG_MODE_POWER_DOWN	 0 // Power-Down
+#define INA219_CFG_MODE_SHUNT_TRG	 1 // Shunt voltage, triggered
+#define INA219_CFG_MODE_BUS_TRG		 2 // Bus voltage, triggered
+#define INA219_CFG_MODE_SHUNT_BUS_TRG	 3 // Shunt and bus voltage, triggered
+#define INA219_CFG_MODE_ADC_OFF		 4 // ADC off (disabled)
+#define INA219_CFG_MODE_SHUNT_CNT	 5 // Shunt voltage, continuous
+#define INA219_CFG_MODE_BUS_CNT		 6 // Bus voltage, continuous
+#define INA219_CFG_MODE_SHUNT_BUS_CNT	 7 // Shunt and bus voltage, continuous
+
+// INA219 Bus Voltage Register Bit Definitions
+#define INA219_BUS_V_RESERVED	     BIT(2) // Reserved, reads as zero
+#define INA219_BUS_V_CNVR	     BIT(1) // Conversion Ready
+#define INA219_BUS_V_OVF	     BIT(0) // Math Overflow Flag
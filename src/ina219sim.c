@@ -0,0 +1,763 @@
+//
+// INA219 Simulator
+//
+// © Copyright 2026 Glider bv
+//
+// This file is subject to the terms and conditions of the GNU General Public
+// License, version 2.
+//
+
+#ifdef INA219_SIM
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <twi.h>
+
+#include "cmd.h"
+#include "ina219.h"
+#include "ina219reg.h"
+#include "ina219sim.h"
+#include "print.h"
+#include "pt.h"
+#include "task.h"
+#include "util.h"
+
+/*
+ * Replaces the I2C bus by a register model of up to INA219_MAX INA219s, so
+ * the driver, the acquisition, and the power monitor can be exercised on a
+ * board without power monitors (build with M_INA219_SIM).
+ *
+ * Each device produces a programmable current waveform at a fixed bus
+ * voltage, and the Shunt Voltage, Current, and Power Registers are derived
+ * from it like the INA219 does, including saturation and the Math Overflow
+ * Flag.  NACKs, short reads, and overflows can be injected, and a device can
+ * be replaced by a foreign device, which reads as all ones.  Errors are
+ * returned like the real TWI layer does: non-blocking transfers fail with
+ * -EIO for a short read, or the negated i2c_status (e.g. -2 for an address
+ * NACK).
+ *
+ * Transfers are not slowed down to the bus speed, but their duration is
+ * derived from the number of bits on the bus at the configured frequency.
+ * Blocking transfers busy-wait for that time, non-blocking transfers
+ * complete from a timer.  The number of transactions and the bus time are
+ * counted, to measure the cost of driver changes.
+ */
+#define SIM_DEFAULT_DEVICES	(BIT(0) | BIT(1) | BIT(4))	/* 0x40, 0x41, 0x44 */
+#define SIM_SHUNT_MOHM		100		/* Like ina219_default_params */
+#define SIM_CFG_RESET		0x399f		/* Power-on reset value */
+#define SIM_VBUS_MAX		32000		/* mV */
+#define SIM_BENCH_MAX		100000		/* Sample sets */
+#define SIM_BENCH_BURST		4		/* Sample sets per task run */
+
+/* i2c_status value, as returned by the real TWI layer */
+#define SIM_ADDR_NAK		2
+
+enum ina219_sim_wave {
+	SIM_WAVE_DC,		// Constant low current
+	SIM_WAVE_SQUARE,	// Low current, then high current
+	SIM_WAVE_RAMP,		// From low current to high current
+	SIM_WAVE_NUM
+};
+
+static const char *const ina219_sim_wave_names[SIM_WAVE_NUM] = {
+	[SIM_WAVE_DC] = "dc",
+	[SIM_WAVE_SQUARE] = "square",
+	[SIM_WAVE_RAMP] = "ramp",
+};
+
+struct ina219_sim_cfg {
+	enum ina219_sim_wave wave;
+	int32_t vbus_mV;
+	int32_t lo_uA;
+	int32_t hi_uA;
+	uint32_t period_us;
+	unsigned int nack;	// NACK every n-th transaction, 0 = never
+	unsigned int short_read;	// Short read every n-th read, 0 = never
+	uint8_t ovf;		// Force the Math Overflow Flag
+	uint8_t present;
+	uint8_t foreign;	// Not an INA219
+};
+
+static struct ina219_sim {
+	struct ina219_sim_cfg cfg;
+	/* Device state */
+	uint16_t config;	// Configuration Register
+	uint16_t calib;		// Calibration Register
+	uint8_t pointer;	// Register pointer
+	uint32_t cnvr_start;	// µs, when CNVR was last cleared
+	unsigned int xfers;	// Transactions, for NACK injection
+	unsigned int reads;	// Register reads, for short read injection
+} ina219_sim[INA219_MAX];
+
+static uint32_t ina219_sim_freq = TWI_FREQ;
+
+static struct {
+	unsigned int xfers;	// Transactions (START to STOP or repeated START)
+	unsigned int bytes;	// Including address bytes
+	unsigned int nacks;
+	unsigned int reads;	// Completed multi-register reads
+	uint64_t bus_ns;
+} ina219_sim_stats;
+
+/* Pending non-blocking transfer */
+static struct {
+	volatile uint8_t busy;
+	uint8_t started;	// On the bus, completing a task period later
+	int res;
+	void (*done)(int res);
+} ina219_sim_async;
+
+static struct ina219_sim *ina219_sim_get(uint8_t addr)
+{
+	if (addr < INA219_BASE || addr >= INA219_BASE + INA219_MAX)
+		return NULL;
+
+	return &ina219_sim[addr - INA219_BASE];
+}
+
+static void ina219_sim_reset(struct ina219_sim *sim)
+{
+	sim->config = SIM_CFG_RESET;
+	sim->calib = 0;
+	sim->pointer = INA219_CFG;
+	sim->cnvr_start = micros();
+}
+
+static int32_t ina219_sim_current_uA(const struct ina219_sim *sim,
+				     uint32_t t)
+{
+	const struct ina219_sim_cfg *cfg = &sim->cfg;
+	uint32_t phase;
+
+	if (cfg->wave == SIM_WAVE_DC || !cfg->period_us)
+		return cfg->lo_uA;
+
+	phase = t % cfg->period_us;
+	if (cfg->wave == SIM_WAVE_SQUARE)
+		return phase < cfg->period_us / 2 ? cfg->lo_uA : cfg->hi_uA;
+
+	return cfg->lo_uA + (int64_t)(cfg->hi_uA - cfg->lo_uA) * phase /
+			    cfg->period_us;
+}
+
+static int32_t ina219_sim_clamp(int32_t x, int32_t min, int32_t max)
+{
+	return x < min ? min : x > max ? max : x;
+}
+
+/* Register value as the INA219 would return it at time t */
+static uint16_t ina219_sim_reg(struct ina219_sim *sim, uint8_t reg,
+			       uint32_t t)
+{
+	int32_t shunt, shunt_max, vbus_mV;
+	int64_t current;
+	uint32_t bus, power;
+	uint16_t flags = 0;
+
+	if (sim->cfg.foreign)
+		return 0xffff;
+
+	switch (reg) {
+	case INA219_CFG:
+		return sim->config;
+
+	case INA219_CALIB:
+		return sim->calib;
+	}
+
+	// Shunt voltage (10 µV LSB), saturating at the PGA range
+	shunt_max = 4000 << ((sim->config & INA219_CFG_GAIN_MASK) >> 11);
+	shunt = (int64_t)ina219_sim_current_uA(sim, t) * SIM_SHUNT_MOHM /
+		10000;
+	shunt = ina219_sim_clamp(shunt, -shunt_max, shunt_max);
+
+	// Bus voltage (4 mV LSB)
+	vbus_mV = sim->config & INA219_CFG_BRNG ? SIM_VBUS_MAX
+						: SIM_VBUS_MAX / 2;
+	bus = ina219_sim_clamp(sim->cfg.vbus_mV, 0, vbus_mV) / 4;
+
+	// Current and Power Registers, only valid when calibrated
+	current = (int64_t)shunt * sim->calib / 4096;
+	if (current < INT16_MIN || current > INT16_MAX) {
+		current = ina219_sim_clamp(current, INT16_MIN, INT16_MAX);
+		flags |= INA219_BUS_V_OVF;
+	}
+	power = (current < 0 ? -current : current) * bus / 5000;
+	if (power > UINT16_MAX) {
+		power = UINT16_MAX;
+		flags |= INA219_BUS_V_OVF;
+	}
+	if (sim->cfg.ovf)
+		flags |= INA219_BUS_V_OVF;
+	if (t - sim->cnvr_start >= ina219_config_us(sim->config))
+		flags |= INA219_BUS_V_CNVR;
+
+	switch (reg) {
+	case INA219_SHUNT_V:
+		return shunt;
+
+	case INA219_BUS_V:
+		return bus << 3 | flags;
+
+	case INA219_POWER:
+		// Reading the Power Register clears CNVR
+		sim->cnvr_start = t;
+		return power;
+
+	case INA219_CURRENT:
+		return current;
+
+	default:
+		return 0;
+	}
+}
+
+static void ina219_sim_write_reg(struct ina219_sim *sim, uint8_t reg,
+				 uint16_t val)
+{
+	switch (reg) {
+	case INA219_CFG:
+		if (val & INA219_CFG_RST) {
+			ina219_sim_reset(sim);
+			return;
+		}
+		sim->config = val;
+		sim->cnvr_start = micros();
+		break;
+
+	case INA219_CALIB:
+		// Bit 0 is not used
+		sim->calib = val & ~1;
+		break;
+	}
+}
+
+/*
+ * Account for a transaction of n data bytes, and return zero or an
+ * i2c_status error code.  A NACKed transaction ends after the address.
+ */
+static int ina219_sim_xfer(struct ina219_sim *sim, unsigned int n,
+			   uint32_t *bits)
+{
+	int res = 0;
+
+	if (!sim || !sim->cfg.present ||
+	    (sim->cfg.nack && !(++sim->xfers % sim->cfg.nack))) {
+		ina219_sim_stats.nacks++;
+		res = SIM_ADDR_NAK;
+		n = 0;
+	}
+
+	// START, address byte and data bytes with ACK bits, STOP
+	ina219_sim_stats.xfers++;
+	ina219_sim_stats.bytes += n + 1;
+	*bits += 9 * (n + 1) + 2;
+	return res;
+}
+
+/* Should a register read end early? */
+static int ina219_sim_short(struct ina219_sim *sim)
+{
+	return sim->cfg.short_read && !(++sim->reads % sim->cfg.short_read);
+}
+
+/* Account for the bus time of a transfer, and return it in µs */
+static uint32_t ina219_sim_bus_us(uint32_t bits)
+{
+	ina219_sim_stats.bus_ns += (uint64_t)bits * 1000000000 /
+				   ina219_sim_freq;
+	return ((uint64_t)bits * 1000000 + ina219_sim_freq - 1) /
+	       ina219_sim_freq;
+}
+
+/* Read n registers like twi_readRegistersAsync(), returning the result */
+static int ina219_sim_read_regs(uint8_t address, const uint8_t *regs,
+				uint8_t n, uint8_t *data, uint8_t length,
+				uint32_t *bits)
+{
+	struct ina219_sim *sim = ina219_sim_get(address);
+	uint32_t t = micros();
+	unsigned int i, j;
+	uint16_t val;
+	int res;
+
+	for (i = 0; i < n; i++) {
+		res = ina219_sim_xfer(sim, 1, bits);
+		if (res)
+			return -res;
+		sim->pointer = regs[i];
+
+		if (ina219_sim_short(sim)) {
+			ina219_sim_xfer(sim, length - 1, bits);
+			return -EIO;
+		}
+
+		res = ina219_sim_xfer(sim, length, bits);
+		if (res)
+			return -res;
+		val = ina219_sim_reg(sim, regs[i], t);
+		for (j = 0; j < length; j++)
+			data[i * length + j] = j & 1 ? val : val >> 8;
+	}
+
+	ina219_sim_stats.reads++;
+	return n * length;
+}
+
+static void ina219_sim_async_done(void)
+{
+	void (*done)(int res) = ina219_sim_async.done;
+
+	ina219_sim_async.busy = 0;
+	done(ina219_sim_async.res);
+}
+
+/*
+ * Non-blocking transfers complete from their own task instead of from the
+ * shared timer pool, so they cannot exhaust it.  The task is queued with
+ * the bus time of the transfer as its period: its first run, right away,
+ * starts the transfer, and the next run completes it.
+ */
+static int ina219_sim_async_run(void)
+{
+	if (!ina219_sim_async.started) {
+		ina219_sim_async.started = 1;
+		return 0;
+	}
+
+	ina219_sim_async_done();
+	if (!ina219_sim_async.busy)
+		return TASK_DONE;
+
+	/* Chained from the completion, so already on the bus */
+	ina219_sim_async.started = 1;
+	return 0;
+}
+
+static struct task task_ina219_sim_async = {
+	.name = "sim i2c",
+	.func = ina219_sim_async_run,
+	.policy = TASK_RESCHEDULE,
+	.prio = TASK_PRIO_HIGH,
+};
+
+/* Finish a pending non-blocking transfer right away */
+void twi_asyncWait(void)
+{
+	if (!ina219_sim_async.busy)
+		return;
+
+	task_del(&task_ina219_sim_async);
+	ina219_sim_async_done();
+}
+
+void twi_init(void)
+{
+	struct ina219_sim *sim;
+	unsigned int i;
+
+	for (i = 0; i < INA219_MAX; i++) {
+		sim = &ina219_sim[i];
+		sim->cfg = (struct ina219_sim_cfg){
+			.wave = SIM_WAVE_DC,
+			.vbus_mV = 5000,
+			.lo_uA = 100000,
+			.hi_uA = 100000,
+			.present = !!(SIM_DEFAULT_DEVICES & BIT(i)),
+		};
+		ina219_sim_reset(sim);
+	}
+
+	pr_info("INA219 simulator at %u kHz\n", ina219_sim_freq / 1000);
+}
+
+void twi_setFrequency(uint32_t frequency)
+{
+	twi_asyncWait();
+	ina219_sim_freq = frequency;
+}
+
+uint32_t twi_getFrequency(void)
+{
+	return ina219_sim_freq;
+}
+
+uint8_t twi_readFrom(uint8_t address, uint8_t *data, uint8_t length,
+		     uint8_t sendStop)
+{
+	struct ina219_sim *sim = ina219_sim_get(address);
+	uint32_t bits = 0;
+	unsigned int i;
+	uint16_t val;
+
+	twi_asyncWait();
+	if (sim && sim->cfg.present && ina219_sim_short(sim))
+		length--;
+	if (ina219_sim_xfer(sim, length, &bits)) {
+		delayMicroseconds(ina219_sim_bus_us(bits));
+		return 0;
+	}
+
+	// The register is sent repeatedly, most significant byte first
+	val = ina219_sim_reg(sim, sim->pointer, micros());
+	for (i = 0; i < length; i++)
+		data[i] = i & 1 ? val : val >> 8;
+
+	delayMicroseconds(ina219_sim_bus_us(bits));
+	return length;
+}
+
+uint8_t twi_writeTo(uint8_t address, uint8_t *data, uint8_t length,
+		    uint8_t wait, uint8_t sendStop)
+{
+	struct ina219_sim *sim = ina219_sim_get(address);
+	uint32_t bits = 0;
+	int res;
+
+	twi_asyncWait();
+	res = ina219_sim_xfer(sim, length, &bits);
+	if (!res && length)
+		sim->pointer = data[0];
+	if (!res && length >= 3)
+		ina219_sim_write_reg(sim, data[0], data[1] << 8 | data[2]);
+
+	delayMicroseconds(ina219_sim_bus_us(bits));
+	return res;
+}
+
+int twi_readRegistersAsync(uint8_t address, const uint8_t *regs, uint8_t n,
+			   uint8_t *data, uint8_t length, void (*done)(int res))
+{
+	uint32_t bits = 0;
+
+	if (ina219_sim_async.busy)
+		return -1;
+
+	ina219_sim_async.res = ina219_sim_read_regs(address, regs, n, data,
+						    length, &bits);
+	ina219_sim_async.done = done;
+	ina219_sim_async.busy = 1;
+	ina219_sim_async.started = 0;
+	/* Still queued when chained from the completion of the previous one */
+	task_ina219_sim_async.period = ina219_sim_bus_us(bits);
+	task_add(&task_ina219_sim_async);
+	return 0;
+}
+
+int twi_readRegisters(uint8_t address, const uint8_t *regs, uint8_t n,
+		      uint8_t *data, uint8_t length)
+{
+	uint32_t bits = 0;
+	int res;
+
+	twi_asyncWait();
+	res = ina219_sim_read_regs(address, regs, n, data, length, &bits);
+	delayMicroseconds(ina219_sim_bus_us(bits));
+	return res;
+}
+
+uint8_t twi_asyncBusy(void)
+{
+	return ina219_sim_async.busy;
+}
+
+void twi_asyncAbort(void)
+{
+	if (!ina219_sim_async.busy)
+		return;
+
+	task_del(&task_ina219_sim_async);
+	ina219_sim_async.res = -ETIMEDOUT;
+	ina219_sim_async_done();
+}
+
+void twi_stop(void)
+{
+}
+
+static int param_is(const char *s, size_t n, const char *name)
+{
+	return n == strlen(name) && !strncmp(s, name, n);
+}
+
+/*
+ * Parse a comma-separated list of <param>=<val>: the waveform (dc, square,
+ * or ramp), the bus voltage in mV, the low and high currents in mA, the
+ * period in ms, NACK every n-th transaction, and forcing the Math Overflow
+ * Flag or the presence of the device (0 or 1).
+ */
+static int ina219_sim_parse_params(const char *s, struct ina219_sim_cfg *cfg)
+{
+	const char *val;
+	unsigned int i;
+	char *end;
+	size_t n;
+	long x;
+
+	while (*s) {
+		n = strcspn(s, "=,");
+		if (s[n] != '=')
+			goto error;
+
+		val = s + n + 1;
+		if (param_is(s, n, "wave")) {
+			end = (char *)val + strcspn(val, ",");
+			for (i = 0; i < SIM_WAVE_NUM; i++)
+				if (param_is(val, end - val,
+					     ina219_sim_wave_names[i]))
+					break;
+			if (i == SIM_WAVE_NUM)
+				goto error;
+			cfg->wave = i;
+		} else {
+			x = strtol(val, &end, 10);
+			if (end == val || x < -INT32_MAX / 1000 ||
+			    x > INT32_MAX / 1000)
+				goto error;
+
+			if (param_is(s, n, "vbus") && x >= 0)
+				cfg->vbus_mV = x;
+			else if (param_is(s, n, "ilo"))
+				cfg->lo_uA = x * 1000;
+			else if (param_is(s, n, "ihi"))
+				cfg->hi_uA = x * 1000;
+			else if (param_is(s, n, "period") && x >= 0)
+				cfg->period_us = x * 1000;
+			else if (param_is(s, n, "nack") && x >= 0)
+				cfg->nack = x;
+			else if (param_is(s, n, "short") && x >= 0)
+				cfg->short_read = x;
+			else if (param_is(s, n, "ovf"))
+				cfg->ovf = !!x;
+			else if (param_is(s, n, "present"))
+				cfg->present = !!x;
+			else if (param_is(s, n, "foreign"))
+				cfg->foreign = !!x;
+			else
+				goto error;
+		}
+
+		if (*end == ',')
+			end++;
+		else if (*end)
+			goto error;
+		s = end;
+	}
+
+	return 0;
+
+error:
+	pr_err("Invalid simulator parameters %s\n", s);
+	return -1;
+}
+
+/*
+ * Configure the simulated device at address addr (all if addr < 0), and
+ * show the configuration
+ */
+int ina219_sim_config(int addr, int argc, char *argv[])
+{
+	const struct ina219_sim_cfg *cfg;
+	struct ina219_sim_cfg new;
+	unsigned int i;
+	int j;
+
+	if (addr >= 0 && !ina219_sim_get(addr)) {
+		pr_err("Invalid address %#x\n", addr);
+		return -1;
+	}
+
+	for (i = 0; i < INA219_MAX; i++) {
+		if (addr >= 0 && INA219_BASE + i != addr)
+			continue;
+
+		cfg = &ina219_sim[i].cfg;
+		if (argc) {
+			new = *cfg;
+			for (j = 0; j < argc; j++)
+				if (ina219_sim_parse_params(argv[j], &new))
+					return -1;
+
+			ina219_sim[i].cfg = new;
+		}
+
+		if (addr < 0 && !cfg->present)
+			continue;
+
+		printf("%#x: %s %" PRId32 " mV, %" PRId32 "..%" PRId32
+		       " mA, %s, period %" PRIu32 " ms",
+		       INA219_BASE + i, cfg->present ? "present" : "absent",
+		       cfg->vbus_mV, cfg->lo_uA / 1000, cfg->hi_uA / 1000,
+		       ina219_sim_wave_names[cfg->wave],
+		       cfg->period_us / 1000);
+		if (cfg->nack)
+			printf(", NACK every %u", cfg->nack);
+		if (cfg->short_read)
+			printf(", short read every %u", cfg->short_read);
+		if (cfg->ovf)
+			printf(", overflow");
+		if (cfg->foreign)
+			printf(", foreign");
+		printf("\n");
+	}
+
+	return 0;
+}
+
+void ina219_sim_show_stats(void)
+{
+	unsigned int reads = ina219_sim_stats.reads;
+	uint32_t bus_us = ina219_sim_stats.bus_ns / 1000;
+
+	printf("%u transactions, %u bytes, %u NACKs, %" PRIu32 " us bus time at %" PRIu32 " kHz\n",
+	       ina219_sim_stats.xfers, ina219_sim_stats.bytes,
+	       ina219_sim_stats.nacks, bus_us, ina219_sim_freq / 1000);
+	if (reads)
+		printf("Per register set read: %u.%02u transactions, %u.%02u bytes, %" PRIu32 " us\n",
+		       ina219_sim_stats.xfers / reads,
+		       ina219_sim_stats.xfers % reads * 100 / reads,
+		       ina219_sim_stats.bytes / reads,
+		       ina219_sim_stats.bytes % reads * 100 / reads,
+		       bus_us / reads);
+}
+
+void ina219_sim_reset_stats(void)
+{
+	ina219_sim_stats = (typeof(ina219_sim_stats)){ };
+}
+
+/*
+ * Read all channels sets times, both through the path the acquisition uses,
+ * the Shunt and Bus Voltage Registers through the non-blocking driver path,
+ * and for comparison all result registers through the blocking driver path,
+ * and report the transactions and bus time per sample set (one read of all
+ * channels).  Runs in the background, in bursts of SIM_BENCH_BURST sample
+ * sets, so the bridges keep on running.  Only the transfers of the bursts
+ * are accounted, not those of the acquisition in between.
+ */
+struct ina219_sim_bench_cost {
+	unsigned int xfers;
+	unsigned int bytes;
+	uint64_t bus_ns;
+};
+
+static struct ina219_sim_bench_state {
+	struct pt pt;
+	unsigned int sets;	// Requested
+	unsigned int set;	// Completed
+	unsigned int errors;
+	struct ina219_sim_bench_cost acquire;
+	struct ina219_sim_bench_cost all;
+} ina219_sim_bench_state;
+
+/* Add the cost since the previous call to c */
+static void ina219_sim_bench_account(struct ina219_sim_bench_cost *c)
+{
+	static struct ina219_sim_bench_cost last;
+
+	if (c) {
+		c->xfers += ina219_sim_stats.xfers - last.xfers;
+		c->bytes += ina219_sim_stats.bytes - last.bytes;
+		c->bus_ns += ina219_sim_stats.bus_ns - last.bus_ns;
+	}
+	last.xfers = ina219_sim_stats.xfers;
+	last.bytes = ina219_sim_stats.bytes;
+	last.bus_ns = ina219_sim_stats.bus_ns;
+}
+
+static void ina219_sim_bench_done(unsigned int ch, int error)
+{
+	if (error)
+		ina219_sim_bench_state.errors++;
+}
+
+static void ina219_sim_bench_print(const char *name,
+				   const struct ina219_sim_bench_cost *c,
+				   unsigned int sets)
+{
+	printf("%-14s  %9u.%02u  %5u.%02u  %8" PRIu32 "\n", name,
+	       c->xfers / sets, c->xfers % sets * 100 / sets,
+	       c->bytes / sets, c->bytes % sets * 100 / sets,
+	       (uint32_t)(c->bus_ns / 1000 / sets));
+}
+
+static void ina219_sim_bench_report(const struct ina219_sim_bench_state *b)
+{
+	printf("%u sample sets of %u channels, %u errors\n", b->sets,
+	       ina219_num_channels(), b->errors);
+	printf("Per sample set  Transactions     Bytes  Bus (us)\n");
+	ina219_sim_bench_print("Acquisition", &b->acquire, b->sets);
+	ina219_sim_bench_print("All registers", &b->all, b->sets);
+}
+
+static int ina219_sim_bench_run(void)
+{
+	struct ina219_sim_bench_state *b = &ina219_sim_bench_state;
+	unsigned int num_ch = ina219_num_channels(), ch, i;
+	struct pt *pt = &b->pt;
+	struct ina219_raw raw;
+
+	PT_BEGIN(pt);
+
+	while (b->set < b->sets) {
+		/* Interrupted by CTRL-C? */
+		if (cmd_mode != CMD_BUSY)
+			PT_EXIT(pt);
+
+		/* Completing a transfer of the acquisition may start the next */
+		while (twi_asyncBusy())
+			twi_asyncWait();
+
+		for (i = 0; i < SIM_BENCH_BURST && b->set < b->sets;
+		     i++, b->set++) {
+			ina219_sim_bench_account(NULL);
+			for (ch = 0; ch < num_ch; ch++) {
+				if (ina219_read_async(ch, &raw,
+						      ina219_sim_bench_done))
+					b->errors++;
+				twi_asyncWait();
+			}
+			ina219_sim_bench_account(&b->acquire);
+
+			for (ch = 0; ch < num_ch; ch++)
+				if (ina219_read_all(ch, &raw))
+					b->errors++;
+			ina219_sim_bench_account(&b->all);
+		}
+
+		PT_YIELD(pt);
+	}
+
+	ina219_sim_bench_report(b);
+	cmd_done();
+
+	PT_END(pt);
+}
+
+static struct task task_ina219_sim_bench = {
+	.name = "sim bench",
+	.func = ina219_sim_bench_run,
+	.period = 0,
+	.policy = TASK_RESCHEDULE,
+};
+
+/* Start the benchmark in the background */
+void ina219_sim_bench(unsigned int sets)
+{
+	if (!ina219_num_channels() || !sets || sets > SIM_BENCH_MAX) {
+		pr_err("Need 1-%u sample sets and at least one channel\n",
+		       SIM_BENCH_MAX);
+		return;
+	}
+
+	ina219_sim_bench_state = (struct ina219_sim_bench_state){
+		.sets = sets,
+	};
+	PT_INIT(&ina219_sim_bench_state.pt);
+	cmd_mode = CMD_BUSY;
+	task_add(&task_ina219_sim_bench);
+}
+
+#endif /* INA219_SIM */
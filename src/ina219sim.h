@@ -0,0 +1,13 @@
+//
+// INA219 Simulator
+//
+// © Copyright 2026 Glider bv
+//
+// This file is subject to the terms and conditions of the GNU General Public
+// License, version 2.
+//
+
+extern int ina219_sim_config(int addr, int argc, char *argv[]);
+extern void ina219_sim_show_stats(void);
+extern void ina219_sim_reset_stats(void);
+extern void ina219_sim_bench(unsigned int sets);
@@ -7,85 +7,481 @@
 // License, version 2.
 //
 
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "acquire.h"
+#include "board.h"
 #include "cmd.h"
+#include "env.h"
 #include "ina219.h"
 #include "measure.h"
 #include "print.h"
+#include "stream.h"
 #include "task.h"
 #include "util.h"
 
-#define FSHIFT		11		/* nr of bits of precision */
+/*
+ * Exponential moving averages over NUM_AVGS configurable time constants,
+ * updated every monitor interval.  The monitor task may run late, so the
+ * fixed-point decay factors are derived from the time constants and the
+ * actual time between the last samples of two consecutive updates.
+ */
+#define FSHIFT		20		/* nr of bits of precision */
 #define FIXED_1		(1 << FSHIFT)	/* 1.0 as fixed-point */
-#define EXP_1		1884		/* 1/exp(5sec/1min) as fixed-point */
-#define EXP_5		2014		/* 1/exp(5sec/5min) */
-#define EXP_15		2037		/* 1/exp(5sec/15min) */
 
 #define CALC_LOAD(load,exp,n) \
 	load *= exp; \
 	load += n * (FIXED_1 - exp); \
 	load >>= FSHIFT;
 
+#define NUM_AVGS		3
+#define MEASURE_MIN_INTERVAL	10		/* ms */
+#define MEASURE_MAX_INTERVAL	60000		/* ms */
+#define MEASURE_MAX_WINDOW	3600		/* s */
+#define PEAK_WINDOW		10		/* s */
+
+static unsigned int measure_interval = 1000;	// ms
+static unsigned int measure_windows[NUM_AVGS] = { 60, 300, 900 };	// s
+static uint32_t exp_avgs[NUM_AVGS];
+static uint32_t exp_peak;
+
 struct avgs {
-	unsigned int curr;
-	unsigned int avg1;
-	unsigned int avg5;
-	unsigned int avg15;
+	int curr;
+	int64_t avg[NUM_AVGS];	// fixed-point
+	uint8_t valid;
 };
 
-static struct avgs vbus[2] = { { 0xffffffff, }, { 0xffffffff, } };
-static struct avgs vshunt[2] = { { 0xffffffff, }, { 0xffffffff, } };
-static struct avgs power[2] = { { 0xffffffff, }, { 0xffffffff, } };
-static struct avgs current[2] = { { 0xffffffff, }, { 0xffffffff, } };
+static struct avgs *vbus, *vshunt, *power, *current;
 
-static void avgs_update(struct avgs *avgs, unsigned int val)
+static void avgs_update(struct avgs *avgs, int val)
 {
-	if (avgs->curr == 0xffffffff) {
-		avgs->avg1 = avgs->avg5 = avgs->avg15 = avgs->curr = val;
+	int64_t n = (int64_t)val * FIXED_1;
+	unsigned int i;
+
+	if (!avgs->valid) {
+		for (i = 0; i < NUM_AVGS; i++)
+			avgs->avg[i] = n;
+		avgs->curr = val;
+		avgs->valid = 1;
 		return;
 	}
 
 	avgs->curr = val;
-	CALC_LOAD(avgs->avg1, EXP_1, val);
-	CALC_LOAD(avgs->avg5, EXP_5, val);
-	CALC_LOAD(avgs->avg15, EXP_15, val);
+	for (i = 0; i < NUM_AVGS; i++) {
+		CALC_LOAD(avgs->avg[i], exp_avgs[i], n);
+	}
+}
+
+static int avgs_get(const struct avgs *avgs, unsigned int i)
+{
+	return (avgs->avg[i] + FIXED_1 / 2) >> FSHIFT;
+}
+
+/*
+ * Return exp(-t / tau) as fixed-point, using a Taylor series on a range
+ * reduced argument, followed by repeated squaring
+ */
+static uint32_t fixed_exp(uint32_t t, uint32_t tau)
+{
+	uint64_t x = ((uint64_t)t << FSHIFT) / tau;
+	uint64_t res = FIXED_1, term = FIXED_1;
+	unsigned int i, m = 0;
+
+	while (x > FIXED_1 / 4) {
+		x >>= 1;
+		m++;
+	}
+
+	for (i = 1; term; i++) {
+		term = ((term * x) >> FSHIFT) / i;
+		if (i & 1)
+			res -= term;
+		else
+			res += term;
+	}
+
+	while (m--)
+		res = (res * res + FIXED_1 / 2) >> FSHIFT;
+
+	return res;
+}
+
+static void measure_update_exp(uint32_t dt)
+{
+	unsigned int i;
+
+	for (i = 0; i < NUM_AVGS; i++)
+		exp_avgs[i] = fixed_exp(dt, measure_windows[i] * 1000000);
+	exp_peak = fixed_exp(dt, PEAK_WINDOW * 1000000);
+}
+
+/*
+ * Per-sample statistics: minimum, maximum, a peak-hold value that decays
+ * towards the current average with a PEAK_WINDOW time constant, and mean
+ * and (population) variance.
+ *
+ * To keep the per-sample cost down, samples are first summed into a batch,
+ * relative to the first sample of the batch, and each batch is merged into
+ * the running mean and variance when the samples have been drained (Chan et
+ * al.'s generalization of Welford's algorithm).  A batch is bounded by the
+ * acquisition ring size, so its sums cannot overflow.
+ */
+#define STATS_SHIFT	4		/* nr of fractional bits of the mean */
+#define STATS_N_MAX	(1U << 30)	/* Saturate the sample count */
+
+enum {
+	STATS_VBUS,		// mV
+	STATS_VSHUNT,		// µV
+	STATS_POWER,		// µW
+	STATS_CURRENT,		// µA
+	STATS_NUM
+};
+
+struct stats {
+	int32_t min;
+	int32_t max;
+	int32_t peak;
+	uint32_t n;
+	int64_t mean;		// << STATS_SHIFT
+	int64_t var;
+	/* Current batch */
+	int32_t ref;
+	uint32_t bn;
+	int64_t bsum;
+	uint64_t bsq;
+};
+
+static struct stats (*stats)[STATS_NUM];
+
+static void stats_add(struct stats *s, int32_t x)
+{
+	int32_t d;
+
+	if (!s->n && !s->bn) {
+		s->min = s->max = s->peak = x;
+	} else {
+		if (x < s->min)
+			s->min = x;
+		if (x > s->max)
+			s->max = x;
+		if (x > s->peak)
+			s->peak = x;
+	}
+
+	if (!s->bn)
+		s->ref = x;
+	d = x - s->ref;
+	s->bn++;
+	s->bsum += d;
+	s->bsq += (int64_t)d * d;
+}
+
+static void stats_merge(struct stats *s)
+{
+	uint32_t na = s->n, nb = s->bn, n;
+	int64_t mean, var, delta, sq;
+
+	if (!nb)
+		return;
+
+	mean = (int64_t)s->ref * (1 << STATS_SHIFT) +
+	       DIV_ROUND_CLOSEST(s->bsum * (1 << STATS_SHIFT), (int64_t)nb);
+	/* bsum² / nb, without truncating the batch mean, or overflowing */
+	sq = s->bsum * (s->bsum / nb) +
+	     DIV_ROUND_CLOSEST(s->bsum * (s->bsum % nb), (int64_t)nb);
+	var = (int64_t)(s->bsq - sq) / nb;
+
+	if (!na) {
+		s->mean = mean;
+		s->var = var;
+	} else {
+		if (na > STATS_N_MAX - nb)
+			na = STATS_N_MAX - nb;
+		n = na + nb;
+		delta = mean - s->mean;
+		s->mean += DIV_ROUND_CLOSEST(delta * nb, (int64_t)n);
+		delta = ((delta * na / n) * delta) >> (2 * STATS_SHIFT);
+		s->var += (int64_t)nb * (var - s->var + delta) / n;
+	}
+
+	s->n = na + nb;
+	s->bn = 0;
+	s->bsum = 0;
+	s->bsq = 0;
+}
+
+/* Let the peak-hold value decay towards the current average */
+static void stats_decay(struct stats *s, int32_t avg)
+{
+	if (s->n && s->peak > avg)
+		s->peak = avg + (((int64_t)(s->peak - avg) * exp_peak) >>
+				 FSHIFT);
+}
+
+static uint32_t isqrt64(uint64_t x)
+{
+	uint64_t res = 0, bit = 1ULL << 62;
+
+	while (bit > x)
+		bit >>= 2;
+
+	while (bit) {
+		if (x >= res + bit) {
+			x -= res + bit;
+			res = (res >> 1) + bit;
+		} else {
+			res >>= 1;
+		}
+		bit >>= 2;
+	}
+
+	return res;
 }
 
+static unsigned int measure_num_ch;
 static unsigned int ina219_probed;
 
+/* Sums of all samples since the last update */
+static struct measure_acc {
+	int64_t vbus_mV;
+	int64_t vshunt_uV;
+	int64_t power_uW;
+	int64_t current_uA;
+	unsigned int n;
+	uint32_t t;		// µs, timestamp of the last sample
+	uint32_t last_t;	// µs, same, at the previous update
+} *acc;
+
+/*
+ * Energy and charge, integrated over all samples since the last reset,
+ * using the trapezoidal rule.  Power cycling a channel doesn't reset them.
+ */
+#define ENERGY_DIV	(2 * 1000000)	/* Two samples times µs */
+
+static struct measure_energy {
+	int64_t uJ;		// Energy (µW·s)
+	int64_t uC;		// Charge (µA·s)
+	int32_t uJ_rem;		// Remainders (1 / ENERGY_DIV µJ resp. µC)
+	int32_t uC_rem;
+	int32_t last_uW;	// Previous sample
+	int32_t last_uA;
+	uint32_t last_t;	// µs, timestamp of the previous sample
+	uint32_t start;		// ms, time of the last reset
+	uint8_t valid;		// Previous sample is valid
+} *energy;
+
+static void energy_add(int64_t *acc, int32_t *rem, int64_t x)
+{
+	x += *rem;
+	*acc += x / ENERGY_DIV;
+	*rem = x % ENERGY_DIV;
+}
+
+static void energy_update(unsigned int ch, uint32_t t, int32_t uW,
+			  int32_t uA)
+{
+	struct measure_energy *e = &energy[ch];
+	uint32_t dt = t - e->last_t;
+
+	if (e->valid) {
+		energy_add(&e->uJ, &e->uJ_rem, (int64_t)(e->last_uW + uW) * dt);
+		energy_add(&e->uC, &e->uC_rem, (int64_t)(e->last_uA + uA) * dt);
+	}
+
+	e->last_uW = uW;
+	e->last_uA = uA;
+	e->last_t = t;
+	e->valid = 1;
+}
+
+/*
+ * Reverse current, e.g. a board back-feeding through its console pins.  An
+ * event starts when the current drops below -REVERSE_THRESHOLD, and ends
+ * when it is no longer negative.  New events are reported by the measure
+ * task, when printing is possible.
+ */
+#define REVERSE_THRESHOLD	1000	/* µA */
+
+static struct measure_reverse {
+	unsigned int events;
+	unsigned int reported;	// Events reported so far
+	int32_t peak_uA;	// Most negative current of the last event
+	uint8_t active;
+} *reverse;
+
+static void reverse_update(unsigned int ch, int32_t uA)
+{
+	struct measure_reverse *r = &reverse[ch];
+
+	if (r->active) {
+		if (uA >= 0)
+			r->active = 0;
+		else if (uA < r->peak_uA)
+			r->peak_uA = uA;
+		return;
+	}
+
+	if (uA >= -REVERSE_THRESHOLD)
+		return;
+
+	r->active = 1;
+	r->peak_uA = uA;
+	r->events++;
+}
+
+static void reverse_report(void)
+{
+	struct measure_reverse *r;
+	unsigned int ch;
+
+	if (!cmd_may_print())
+		return;
+
+	for (ch = 0; ch < measure_num_ch; ch++) {
+		r = &reverse[ch];
+		if (r->reported == r->events)
+			continue;
+
+		pr_warn("Reverse current on power channel %c: %" PRId32 " uA\n",
+			'A' + ch, r->peak_uA);
+		r->reported = r->events;
+	}
+}
+
+/* Consume all samples acquired so far */
+static int measure_drain(void)
+{
+	int32_t mV, uV, uW, uA;
+	struct ina219_raw raw;
+	struct measure_acc *a;
+	struct stats *s;
+	unsigned int ch, i;
+	uint32_t t;
+
+	for (ch = 0; ch < measure_num_ch; ch++) {
+		a = &acc[ch];
+		s = stats[ch];
+		while (acquire_get(ch, &t, &raw)) {
+			mV = ina219_bus_mV(ch, &raw);
+			uV = ina219_shunt_uV(ch, &raw);
+			uW = ina219_power_uW(ch, &raw);
+			uA = ina219_current_uA(ch, &raw);
+			a->vbus_mV += mV;
+			a->vshunt_uV += uV;
+			a->power_uW += uW;
+			a->current_uA += uA;
+			a->n++;
+			a->t = t;
+			stats_add(&s[STATS_VBUS], mV);
+			stats_add(&s[STATS_VSHUNT], uV);
+			stats_add(&s[STATS_POWER], uW);
+			stats_add(&s[STATS_CURRENT], uA);
+			energy_update(ch, t, uW, uA);
+			reverse_update(ch, uA);
+			stream_add(ch, t, mV, uA, uW);
+		}
+
+		for (i = 0; i < STATS_NUM; i++)
+			stats_merge(&s[i]);
+	}
+
+	return 0;
+}
+
+static struct task task_measure_drain = {
+	.name = "measure drain",
+	.func = measure_drain,
+	.period = HZ / 100,
+	.policy = TASK_SKIP_MISSED,
+	.prio = TASK_PRIO_HIGH,
+};
+
+static int acc_avg(int64_t sum, unsigned int n, unsigned int div)
+{
+	return DIV_ROUND_CLOSEST(sum, (int64_t)n * div);
+}
+
+/*
+ * Print a value in micro-units as milli-units, with three decimals, and the
+ * sign and integer part right-aligned in five columns
+ */
+static void print_milli(const char *pre, int64_t x, const char *post)
+{
+	const char *sign = "";
+	unsigned int width = 5;
+	uint64_t i;
+
+	if (x < 0) {
+		sign = "-";
+		x = -x;
+		width--;
+	}
+
+	for (i = x / 1000; i >= 10 && width > 1; i /= 10)
+		width--;
+
+	printf("%s%*s%s%lu.%03lu%s", pre, width - 1, "", sign,
+	       (unsigned long)(x / 1000), (unsigned long)(x % 1000), post);
+}
+
+static struct task task_measure;
+
 static int measure(void)
 {
+	struct measure_acc *a;
 	unsigned int ch;
 	static int n;
 
-	for (ch = 0; ch < 2; ch++) {
-		if (!(ina219_probed & BIT(ch)))
+	// Apply a new interval (the task is not queued while running)
+	task_measure.period = measure_interval * (HZ / 1000);
+
+	measure_drain();
+	reverse_report();
+
+	for (ch = 0; ch < measure_num_ch; ch++) {
+		a = &acc[ch];
+		if (!a->n)
 			continue;
 
-		avgs_update(&vbus[ch], ina219_get_bus_mV(ch));
-		avgs_update(&vshunt[ch], ina219_get_shunt_uV(ch));
-		avgs_update(&power[ch], ina219_get_power_mW(ch));
-		avgs_update(&current[ch], ina219_get_current_mA(ch));
+		// No decay on the first update
+		measure_update_exp(vbus[ch].valid ? a->t - a->last_t : 0);
+		avgs_update(&vbus[ch], acc_avg(a->vbus_mV, a->n, 1));
+		avgs_update(&vshunt[ch], acc_avg(a->vshunt_uV, a->n, 1));
+		avgs_update(&power[ch], acc_avg(a->power_uW, a->n, 1000));
+		avgs_update(&current[ch], acc_avg(a->current_uA, a->n, 1000));
+		stats_decay(&stats[ch][STATS_VBUS], vbus[ch].curr);
+		stats_decay(&stats[ch][STATS_VSHUNT], vshunt[ch].curr);
+		stats_decay(&stats[ch][STATS_POWER],
+			    acc_avg(a->power_uW, a->n, 1));
+		stats_decay(&stats[ch][STATS_CURRENT],
+			    acc_avg(a->current_uA, a->n, 1));
+		*a = (struct measure_acc){ .last_t = a->t };
 	}
 
 	if (cmd_mode != CMD_MONITOR)
 		return 0;
 
 	if (!(n++ % 20))
-		printf("     Vbus      Vshunt     Power                         Current\n"
-		       "   --------  ---------  ----------------------------  ------------------------\n");
+		printf("     Vbus        Vshunt      Power                         Current                   Energy         Charge\n"
+		       "   --------  ------------  ----------------------------  ------------------------  -------------  -------------\n");
 
-	for (ch = 0; ch < 2; ch++) {
+	for (ch = 0; ch < measure_num_ch; ch++) {
 		if (!(ina219_probed & BIT(ch)))
 			continue;
 
-		printf("%c: %5u mV  %3u.%02u mV  %5u mW (%5u %5u %5u)  %4u mA (%4u %4u %4u)\n",
-		       'A' + ch,
-		       vbus[ch].curr,
-		       vshunt[ch].curr / 1000, vshunt[ch].curr % 1000 / 10,
+		printf("%c: %5d mV", 'A' + ch, vbus[ch].curr);
+		print_milli("  ", vshunt[ch].curr, " mV");
+		printf("  %5d mW (%5d %5d %5d)  %4d mA (%4d %4d %4d)",
 		       power[ch].curr,
-		       power[ch].avg1, power[ch].avg5, power[ch].avg15,
+		       avgs_get(&power[ch], 0), avgs_get(&power[ch], 1),
+		       avgs_get(&power[ch], 2),
 		       current[ch].curr,
-		       current[ch].avg1, current[ch].avg5, current[ch].avg15);
+		       avgs_get(&current[ch], 0), avgs_get(&current[ch], 1),
+		       avgs_get(&current[ch], 2));
+		print_milli("  ", energy[ch].uJ / 3600, " mWh");
+		print_milli("  ", energy[ch].uC / 3600, " mAh\n");
 	}
 
 	return 0;
@@ -95,15 +491,334 @@ static struct task task_measure = {
 	.name = "measure",
 	.func = measure,
 	.period = HZ,
+	.policy = TASK_SKIP_MISSED,
 };
 
+/* Show the monitor interval and averaging windows */
+void measure_show_interval(void)
+{
+	unsigned int i;
+
+	printf("Interval %u ms, averaging windows", measure_interval);
+	for (i = 0; i < NUM_AVGS; i++)
+		printf(" %u", measure_windows[i]);
+	printf(" s\n");
+}
+
+int measure_set_interval(unsigned int ms)
+{
+	if (ms < MEASURE_MIN_INTERVAL || ms > MEASURE_MAX_INTERVAL) {
+		pr_err("Interval must be in the range %u-%u ms\n",
+		       MEASURE_MIN_INTERVAL, MEASURE_MAX_INTERVAL);
+		return -1;
+	}
+
+	measure_interval = ms;
+	return 0;
+}
+
+/* Set the averaging windows from a comma-separated list of seconds */
+int measure_set_windows(const char *s)
+{
+	unsigned int windows[NUM_AVGS];
+	unsigned long x;
+	unsigned int i;
+	char *end;
+
+	for (i = 0; i < NUM_AVGS; i++) {
+		x = strtoul(s, &end, 10);
+		if (end == s || !x || x > MEASURE_MAX_WINDOW ||
+		    *end != (i < NUM_AVGS - 1 ? ',' : '\0'))
+			goto error;
+
+		windows[i] = x;
+		s = end + 1;
+	}
+
+	memcpy(measure_windows, windows, sizeof(windows));
+	return 0;
+
+error:
+	pr_err("Invalid averaging windows, expected %u values in the range 1-%u s\n",
+	       NUM_AVGS, MEASURE_MAX_WINDOW);
+	return -1;
+}
+
+/* Show the energy and charge of the selected channel (all if ch < 0) */
+void measure_show_energy(int ch)
+{
+	const struct measure_energy *e;
+	unsigned int i;
+
+	measure_drain();
+
+	for (i = 0; i < measure_num_ch; i++) {
+		if ((ch >= 0 && i != ch) || !(ina219_probed & BIT(i)))
+			continue;
+
+		e = &energy[i];
+		printf("%c:", 'A' + i);
+		print_milli(" ", e->uJ / 3600, " mWh");
+		print_milli("  ", e->uC / 3600, " mAh");
+		printf("  in %" PRIu32 " s\n", (millis() - e->start) / 1000);
+	}
+}
+
+void measure_reset_energy(int ch)
+{
+	struct measure_energy *e;
+	unsigned int i;
+
+	measure_drain();
+
+	for (i = 0; i < measure_num_ch; i++) {
+		if (ch >= 0 && i != ch)
+			continue;
+
+		// Keep the previous sample, to continue integrating
+		e = &energy[i];
+		e->uJ = e->uC = 0;
+		e->uJ_rem = e->uC_rem = 0;
+		e->start = millis();
+	}
+}
+
+/* Show the statistics of the selected channel (all if ch < 0) */
+void measure_show_stats(int ch)
+{
+	static const char *const names[STATS_NUM] = {
+		[STATS_VBUS] = "  Vbus (V) ",
+		[STATS_VSHUNT] = "Vshunt (mV)",
+		[STATS_POWER] = " Power (mW)",
+		[STATS_CURRENT] = "Current (mA)",
+	};
+	const struct stats *s;
+	unsigned int i, j;
+
+	measure_drain();
+
+	for (i = 0; i < measure_num_ch; i++) {
+		if ((ch >= 0 && i != ch) || !(ina219_probed & BIT(i)))
+			continue;
+
+		printf("%c: %" PRIu32 " samples, %u reverse current events",
+		       'A' + i, stats[i][STATS_VBUS].n, reverse[i].events);
+		if (reverse[i].events)
+			printf(" (last %" PRId32 " uA%s)", reverse[i].peak_uA,
+			       reverse[i].active ? ", ongoing" : "");
+		printf("\n"
+		       "                       Min        Max       Peak       Mean     Stddev\n");
+		for (j = 0; j < STATS_NUM; j++) {
+			s = &stats[i][j];
+			printf("   %-12s", names[j]);
+			if (!s->n) {
+				printf("  -\n");
+				continue;
+			}
+			print_milli("  ", s->min, "");
+			print_milli("  ", s->max, "");
+			print_milli("  ", s->peak, "");
+			print_milli("  ", s->mean >> STATS_SHIFT, "");
+			print_milli("  ", isqrt64(s->var > 0 ? s->var : 0), "\n");
+		}
+	}
+}
+
+void measure_reset_stats(int ch)
+{
+	unsigned int i;
+
+	measure_drain();
+
+	for (i = 0; i < measure_num_ch; i++)
+		if (ch < 0 || i == ch) {
+			memset(stats[i], 0, sizeof(stats[i]));
+			reverse[i].events = reverse[i].reported = 0;
+		}
+}
+
+/* Sample at the conversion time of the slowest channel */
+static unsigned int measure_period(void)
+{
+	unsigned int ch, period = 0;
+
+	for (ch = 0; ch < measure_num_ch; ch++)
+		if ((ina219_probed & BIT(ch)) &&
+		    ina219_conversion_us(ch) > period)
+			period = ina219_conversion_us(ch);
+
+	return period;
+}
+
+static int param_is(const char *s, size_t n, const char *name)
+{
+	return n == strlen(name) && !strncmp(s, name, n);
+}
+
+/*
+ * Parse a comma-separated list of INA219 parameters, e.g.
+ * "shunt=100,imax=3200,adc=12b,brng=32", with the shunt resistance in mΩ,
+ * the maximum expected current in mA, the ADC resolution in bits ("9b" -
+ * "12b") or the number of samples to average ("2s" - "128s"), and the bus
+ * voltage range in V.
+ */
+static int measure_parse_params(const char *s, struct ina219_params *params)
+{
+	unsigned long x;
+	const char *val;
+	char *end;
+	size_t n;
+
+	while (*s) {
+		n = strcspn(s, "=,");
+		if (s[n] != '=')
+			goto error;
+
+		val = s + n + 1;
+		x = strtoul(val, &end, 10);
+		if (end == val)
+			goto error;
+
+		if (param_is(s, n, "shunt")) {
+			params->shunt_mohm = x;
+		} else if (param_is(s, n, "imax")) {
+			params->max_mA = x;
+		} else if (param_is(s, n, "brng")) {
+			params->brng_V = x;
+		} else if (param_is(s, n, "adc") && *end == 'b') {
+			params->adc_bits = x;
+			params->adc_samples = 1;
+			end++;
+		} else if (param_is(s, n, "adc") && *end == 's') {
+			params->adc_bits = 12;
+			params->adc_samples = x;
+			end++;
+		} else {
+			goto error;
+		}
+
+		if (*end == ',')
+			end++;
+		else if (*end)
+			goto error;
+		s = end;
+	}
+
+	return 0;
+
+error:
+	pr_err("Invalid INA219 parameters %s\n", s);
+	return -1;
+}
+
+/*
+ * Show the configuration of the selected channel (all if ch < 0), or
+ * reconfigure it using the parameters in argv[]
+ */
+void measure_config(int ch, int argc, char *argv[])
+{
+	struct ina219_params params;
+	unsigned int i;
+	int j;
+
+	for (i = 0; i < measure_num_ch; i++) {
+		if ((ch >= 0 && i != ch) || !(ina219_probed & BIT(i)))
+			continue;
+
+		if (!argc) {
+			ina219_dump_config(i);
+			continue;
+		}
+
+		ina219_get_params(i, &params);
+		for (j = 0; j < argc; j++)
+			if (measure_parse_params(argv[j], &params))
+				goto out;
+
+		// Don't convert pending samples using the new calibration
+		measure_drain();
+		ina219_configure(i, &params);
+	}
+
+out:
+	// Previous channels may have been reconfigured, even on error
+	if (argc)
+		acquire_set_period(measure_period());
+}
+
+static void measure_free(void)
+{
+	free(vbus);
+	free(vshunt);
+	free(power);
+	free(current);
+	free(stats);
+	free(acc);
+	free(energy);
+	free(reverse);
+	vbus = vshunt = power = current = NULL;
+	stats = NULL;
+	acc = NULL;
+	energy = NULL;
+	reverse = NULL;
+}
+
+/* Allocate the per-channel state for all INA219s found */
+static int measure_alloc(unsigned int n)
+{
+	if (!n) {
+		pr_warn("No INA219s found\n");
+		return -1;
+	}
+
+	vbus = calloc(n, sizeof(*vbus));
+	vshunt = calloc(n, sizeof(*vshunt));
+	power = calloc(n, sizeof(*power));
+	current = calloc(n, sizeof(*current));
+	stats = calloc(n, sizeof(*stats));
+	acc = calloc(n, sizeof(*acc));
+	energy = calloc(n, sizeof(*energy));
+	reverse = calloc(n, sizeof(*reverse));
+	if (!vbus || !vshunt || !power || !current || !stats || !acc ||
+	    !energy || !reverse) {
+		pr_err("Out of memory for %u INA219s\n", n);
+		measure_free();
+		return -1;
+	}
+
+	measure_num_ch = n;
+	return 0;
+}
+
 void measure_init(void)
 {
+	char key[] = "ina219A";
+	struct ina219_params params;
+	const char *var;
 	unsigned int ch;
 	int x;
 
-	for (ch = 0; ch < 2; ch++) {
-		x = ina219_init(ch);
+	var = env_get("moninterval");
+	if (var)
+		measure_set_interval(atoi(var));
+	var = env_get("monwindows");
+	if (var)
+		measure_set_windows(var);
+
+	// The INA219s of the power channels keep their channel numbers
+	if (measure_alloc(ina219_probe(NUM_POWER_CH)))
+		return;
+
+	for (ch = 0; ch < measure_num_ch; ch++) {
+		params = ina219_default_params;
+		key[6] = 'A' + ch;
+		var = env_get(key);
+		if (var && measure_parse_params(var, &params)) {
+			pr_warn("Using defaults for INA219-%u\n", ch);
+			params = ina219_default_params;
+		}
+
+		x = ina219_init(ch, &params);
 		if (x < 0) {
 			pr_err("Initialization of INA219-%u failed: %d\n", ch,
 			       x);
@@ -113,6 +828,10 @@ void measure_init(void)
 		ina219_probed |= BIT(ch);
 	}
 
-	if (ina219_probed)
-		task_add(&task_measure);
+	if (!ina219_probed)
+		return;
+
+	acquire_start(ina219_probed, measure_period());
+	task_add(&task_measure_drain);
+	task_add(&task_measure);
 }
@@ -8,3 +8,11 @@
 //
 
 extern void measure_init(void);
+extern void measure_config(int ch, int argc, char *argv[]);
+extern void measure_show_interval(void);
+extern int measure_set_interval(unsigned int ms);
+extern int measure_set_windows(const char *s);
+extern void measure_show_energy(int ch);
+extern void measure_reset_energy(int ch);
+extern void measure_show_stats(int ch);
+extern void measure_reset_stats(int ch);
@@ -0,0 +1,64 @@
+//
+// Protothreads (Stackless Coroutines)
+//
+// © Copyright 2026 Glider bv
+//
+// This file is subject to the terms and conditions of the GNU General Public
+// License, version 2.
+//
+
+//
+// A protothread is a task function that can yield between steps, and resume
+// where it left off on the next run of the task, e.g.
+//
+//	static struct pt pt;
+//
+//	static int func(void)
+//	{
+//		PT_BEGIN(&pt);
+//		...
+//		PT_YIELD(&pt);
+//		...
+//		PT_END(&pt);
+//	}
+//
+// The continuation is implemented using a switch statement, so:
+//   - local variables are not preserved across PT_YIELD(),
+//   - PT_YIELD() and PT_WAIT_UNTIL() cannot be used inside another switch
+//     statement.
+//
+// The task is removed when the protothread ends. Use a zero period to resume
+// on the next scheduler tick.
+//
+
+struct pt {
+	unsigned int lc;	// local continuation
+};
+
+#define PT_INIT(pt)		((pt)->lc = 0)
+
+#define PT_BEGIN(pt)		switch ((pt)->lc) { case 0:
+
+#define PT_YIELD(pt)						\
+	do {							\
+		(pt)->lc = __LINE__;				\
+		return 0;					\
+	case __LINE__:						\
+		;						\
+	} while (0)
+
+#define PT_WAIT_UNTIL(pt, cond)					\
+	do {							\
+		(pt)->lc = __LINE__;				\
+	case __LINE__:						\
+		if (!(cond))					\
+			return 0;				\
+	} while (0)
+
+#define PT_EXIT(pt)						\
+	do {							\
+		(pt)->lc = 0;					\
+		return TASK_DONE;				\
+	} while (0)
+
+#define PT_END(pt)		} PT_EXIT(pt)
@@ -0,0 +1,223 @@
+//
+// Power Telemetry Streaming
+//
+// © Copyright 2026 Glider bv
+//
+// This file is subject to the terms and conditions of the GNU General Public
+// License, version 2.
+//
+
+#include <string.h>
+
+#include "cmd.h"
+#include "print.h"
+#include "stream.h"
+#include "task.h"
+#include "util.h"
+
+/*
+ * While streaming, every acquired sample is encoded as soon as it has been
+ * drained, and queued in a FIFO.  A low priority task moves the FIFO to the
+ * USB serial port, as fast as the host accepts it.  Samples that don't fit
+ * in the FIFO are dropped, but still consume a sequence number.
+ *
+ * Samples are encoded without printf(), either as fixed-width CSV lines:
+ *
+ *   sssss,tttttttttt,c,vvvvv,±aaaaaaaaa,±wwwwwwwwww
+ *
+ * with sequence number, time (µs), channel, bus voltage (mV), current (µA),
+ * and power (µW), or as binary frames, in native (little) endian, preceded
+ * by a "BFFS" header.
+ */
+#define STREAM_CSV_LEN	48
+#define STREAM_SYNC	0xa5
+
+struct stream_hdr {
+	char magic[4];
+	uint16_t size;		// Frame size
+	uint16_t reserved;
+};
+
+struct stream_frame {
+	uint8_t sync;		// STREAM_SYNC
+	uint8_t ch;
+	uint16_t seq;
+	uint32_t t;		// µs
+	int32_t current_uA;
+	int32_t power_uW;
+	uint16_t vbus_mV;
+	uint16_t sum;		// Sum of all preceding bytes
+};
+
+static struct stream {
+	uint8_t fifo[STREAM_FIFO_SIZE];
+	unsigned int head;	// Free-running
+	unsigned int tail;	// Free-running
+	unsigned int queued, dropped;
+	uint16_t seq;
+	uint8_t binary;
+} stream;
+
+static void stream_put(const void *buf, unsigned int len)
+{
+	unsigned int head = stream.head % STREAM_FIFO_SIZE;
+	unsigned int n = STREAM_FIFO_SIZE - head;
+
+	if (n > len)
+		n = len;
+	memcpy(&stream.fifo[head], buf, n);
+	memcpy(stream.fifo, (const uint8_t *)buf + n, len - n);
+	stream.head += len;
+}
+
+/* Store x as exactly width decimal digits, zero-padded */
+static char *stream_put_dec(char *p, uint32_t x, unsigned int width)
+{
+	unsigned int i;
+
+	for (i = width; i > 0; i--) {
+		p[i - 1] = '0' + x % 10;
+		x /= 10;
+	}
+
+	return p + width;
+}
+
+static char *stream_put_signed(char *p, int32_t x, unsigned int width)
+{
+	*p++ = x < 0 ? '-' : '+';
+	return stream_put_dec(p, x < 0 ? -(uint32_t)x : x, width);
+}
+
+static void stream_put_csv(unsigned int ch, uint32_t t, int32_t mV,
+			   int32_t uA, int32_t uW)
+{
+	char line[STREAM_CSV_LEN], *p = line;
+
+	p = stream_put_dec(p, stream.seq, 5);
+	*p++ = ',';
+	p = stream_put_dec(p, t, 10);
+	*p++ = ',';
+	*p++ = 'A' + ch;
+	*p++ = ',';
+	p = stream_put_dec(p, mV, 5);
+	*p++ = ',';
+	p = stream_put_signed(p, uA, 9);
+	*p++ = ',';
+	p = stream_put_signed(p, uW, 10);
+	*p++ = '\n';
+
+	stream_put(line, p - line);
+}
+
+static void stream_put_frame(unsigned int ch, uint32_t t, int32_t mV,
+			     int32_t uA, int32_t uW)
+{
+	struct stream_frame frame = {
+		.sync = STREAM_SYNC,
+		.ch = ch,
+		.seq = stream.seq,
+		.t = t,
+		.current_uA = uA,
+		.power_uW = uW,
+		.vbus_mV = mV,
+	};
+	const uint8_t *p = (const uint8_t *)&frame;
+	unsigned int i;
+
+	for (i = 0; i < offsetof(struct stream_frame, sum); i++)
+		frame.sum += p[i];
+
+	stream_put(&frame, sizeof(frame));
+}
+
+/* Called for every drained sample */
+void stream_add(unsigned int ch, uint32_t t, int32_t mV, int32_t uA,
+		int32_t uW)
+{
+	unsigned int len = stream.binary ? sizeof(struct stream_frame)
+					 : STREAM_CSV_LEN;
+
+	if (cmd_mode != CMD_STREAM)
+		return;
+
+	if (stream.head - stream.tail > STREAM_FIFO_SIZE - len) {
+		stream.dropped++;
+	} else {
+		if (stream.binary)
+			stream_put_frame(ch, t, mV, uA, uW);
+		else
+			stream_put_csv(ch, t, mV, uA, uW);
+		stream.queued++;
+	}
+
+	stream.seq++;
+}
+
+static int stream_flush(void)
+{
+	unsigned int tail, n;
+	int avail;
+
+	if (cmd_mode != CMD_STREAM)
+		return TASK_DONE;
+
+	while (stream.tail != stream.head) {
+		avail = usb_serial_write_buffer_free();
+		if (avail <= 0)
+			break;
+
+		tail = stream.tail % STREAM_FIFO_SIZE;
+		n = stream.head - stream.tail;
+		if (n > STREAM_FIFO_SIZE - tail)
+			n = STREAM_FIFO_SIZE - tail;
+		if (n > avail)
+			n = avail;
+
+		usb_serial_write(&stream.fifo[tail], n);
+		stream.tail += n;
+	}
+
+	return 0;
+}
+
+static struct task task_stream = {
+	.name = "stream",
+	.func = stream_flush,
+	.period = HZ / 1000,
+	.policy = TASK_SKIP_MISSED,
+};
+
+/* Start streaming, as fixed-width CSV or binary frames */
+void stream_start(int binary)
+{
+	static const char csv_hdr[] = "seq,t_us,ch,vbus_mV,current_uA,power_uW\n";
+	struct stream_hdr hdr = {
+		.magic = { 'B', 'F', 'F', 'S' },
+		.size = sizeof(struct stream_frame),
+	};
+
+	stream.head = stream.tail = 0;
+	stream_reset_stats();
+	stream.seq = 0;
+	stream.binary = binary;
+
+	if (binary)
+		stream_put(&hdr, sizeof(hdr));
+	else
+		stream_put(csv_hdr, sizeof(csv_hdr) - 1);
+
+	task_add(&task_stream);
+}
+
+/* Counts of the current or last stream */
+void stream_show_stats(void)
+{
+	printf("Stream: %u samples, %u dropped\n", stream.queued,
+	       stream.dropped);
+}
+
+void stream_reset_stats(void)
+{
+	stream.queued = stream.dropped = 0;
+}
@@ -0,0 +1,18 @@
+//
+// Power Telemetry Streaming
+//
+// © Copyright 2026 Glider bv
+//
+// This file is subject to the terms and conditions of the GNU General Public
+// License, version 2.
+//
+
+#include <stdint.h>
+
+#define STREAM_FIFO_SIZE	4096	/* Bytes, must be a power of two */
+
+extern void stream_start(int binary);
+extern void stream_add(unsigned int ch, uint32_t t, int32_t mV, int32_t uA,
+		       int32_t uW);
+extern void stream_show_stats(void);
+extern void stream_reset_stats(void);
@@ -7,92 +7,569 @@
 // License, version 2.
 //
 
+#include <inttypes.h>
+
 #include "print.h"
 #include "task.h"
+#include "util.h"
+#include "work.h"
+
+#define TASK_SPIN_US		10	/* Busy-wait below this time to deadline */
+
+#define TASK_LATENCY_BUCKETS	17	/* 0, 1, 2-3, 4-7, ..., >= 32768 us */
+
+/*
+ * Queued tasks are kept in one binary min-heap per priority level, ordered by
+ * deadline (base + period), so tasks[0] is always the next task to run at
+ * that priority level.
+ */
+static struct task_heap {
+	struct task *tasks[TASK_MAX];
+	unsigned int num;
+} heaps[TASK_PRIO_NUM];
+
+static inline struct task_heap *task_heap(const struct task *task)
+{
+	return &heaps[task->prio];
+}
+
+#define for_each_task(_task, _prio, _i)					\
+	for (_prio = TASK_PRIO_NUM - 1; _prio >= 0; _prio--)		\
+		for (_i = 0; _i < heaps[_prio].num &&			\
+			     (_task = heaps[_prio].tasks[_i]); _i++)
+
+/*
+ * One-shot timers are allocated from a static pool, and queued as tasks
+ * without a task function. Timer handles contain a generation count, so
+ * stale handles of expired or reused timers are ignored.
+ */
+static struct timer {
+	struct task task;	/* must be first */
+	void (*func)(unsigned long data);
+	unsigned long data;
+	unsigned int gen;
+} timers[TIMER_MAX];
+static unsigned int timer_gen;
+
+#define TIMER_IDX_BITS		8
+#define TIMER_GEN_MASK		0x7fffff
+
+/* Dispatch latency histogram (deadline vs. actual start of a task) */
+static unsigned int task_latency[TASK_LATENCY_BUCKETS];
+
+/* Time spent sleeping vs. running, since the last reset */
+static struct {
+	uint32_t last;		// us, end of the last accounted period
+	uint64_t busy_us;
+	uint64_t idle_us;
+	unsigned int sleeps;
+} idle_stats;
+
+/*
+ * Cost of servicing USB and UART events in yield().  The minimum is the cost
+ * of a call without any pending events.
+ */
+static struct {
+	unsigned int calls;
+	uint32_t min_cycles;
+	uint32_t max_cycles;
+	uint64_t sum_cycles;
+} yield_stats;
+
+static inline uint32_t task_deadline(const struct task *task)
+{
+	return task->base + task->period;
+}
+
+/*
+ * Deadlines are compared relative to each other, so wraparound of the 32-bit
+ * micros() counter is handled, as long as all deadlines lie within 2^31 us.
+ */
+static inline int task_before(const struct task *a, const struct task *b)
+{
+	return (int32_t)(task_deadline(a) - task_deadline(b)) < 0;
+}
+
+static inline int task_queued(const struct task *task)
+{
+	const struct task_heap *heap = task_heap(task);
+
+	return task->slot < heap->num && heap->tasks[task->slot] == task;
+}
+
+static inline void task_set(struct task_heap *heap, unsigned int i,
+			    struct task *task)
+{
+	heap->tasks[i] = task;
+	task->slot = i;
+}
+
+static void task_sift_up(struct task_heap *heap, unsigned int i)
+{
+	struct task *task = heap->tasks[i];
+	unsigned int parent;
+
+	while (i) {
+		parent = (i - 1) / 2;
+		if (!task_before(task, heap->tasks[parent]))
+			break;
+		task_set(heap, i, heap->tasks[parent]);
+		i = parent;
+	}
+	task_set(heap, i, task);
+}
+
+static void task_sift_down(struct task_heap *heap, unsigned int i)
+{
+	struct task *task = heap->tasks[i];
+	unsigned int child;
+
+	while ((child = 2 * i + 1) < heap->num) {
+		if (child + 1 < heap->num &&
+		    task_before(heap->tasks[child + 1], heap->tasks[child]))
+			child++;
+		if (!task_before(heap->tasks[child], task))
+			break;
+		task_set(heap, i, heap->tasks[child]);
+		i = child;
+	}
+	task_set(heap, i, task);
+}
 
-static struct task *tasks;
+static int task_queue(struct task *task)
+{
+	struct task_heap *heap = task_heap(task);
+
+	if (heap->num == TASK_MAX) {
+		pr_err("Too many tasks, cannot add task %s\n", task->name);
+		return -1;
+	}
+
+	task_set(heap, heap->num++, task);
+	task_sift_up(heap, task->slot);
+	return 0;
+}
 
 void task_add(struct task *task)
 {
+	if (task_queued(task))
+		return;
+
 	task->base = micros() - task->period;
-	task->prev = NULL;
-	task->next = tasks;
-	if (tasks)
-		tasks->prev = task;
-	tasks = task;
+	task_queue(task);
 }
 
 void task_del(struct task *task)
 {
-	if (task->prev)
-		task->prev->next = task->next;
-	else
-		tasks = task->next;
-	if (task->next)
-		task->next->prev = task->prev;
-	task->prev = NULL;
-	task->next = NULL;
+	struct task_heap *heap = task_heap(task);
+	unsigned int i = task->slot;
+
+	if (!task_queued(task))
+		return;
+
+	/* Move the last task into the hole, and restore the heap property */
+	if (i != --heap->num) {
+		task_set(heap, i, heap->tasks[heap->num]);
+		task_sift_down(heap, i);
+		task_sift_up(heap, i);
+	}
+	heap->tasks[heap->num] = NULL;
+}
+
+#define CYCLES_PER_US		(F_CPU / 1000000)
+
+static void task_account(struct task *task, uint32_t late, uint32_t cycles)
+{
+	if (!task->runs || cycles < task->min_cycles)
+		task->min_cycles = cycles;
+	if (cycles > task->max_cycles)
+		task->max_cycles = cycles;
+	task->sum_cycles += cycles;
+	task->runs++;
+	task->late = late;
+}
+
+void task_show_stats(void)
+{
+	const struct task *task;
+	unsigned int i;
+	int prio;
+
+	printf("  Task          Prio      Runs  Overruns   Skipped   Min us   Avg us   Max us  Late us\n"
+	       "  ------------  ----  --------  --------  --------  -------  -------  -------  -------\n");
+	for_each_task(task, prio, i) {
+		printf("  %-12s  %-4s  %8u  %8u  %8u  %7" PRIu32 "  %7" PRIu32
+		       "  %7" PRIu32 "  %7" PRIu32 "\n",
+		       task->name, prio == TASK_PRIO_HIGH ? "high" : "low",
+		       task->runs, task->overruns, task->skipped,
+		       task->min_cycles / CYCLES_PER_US,
+		       task->runs ? (uint32_t)(task->sum_cycles / task->runs) /
+				    CYCLES_PER_US : 0,
+		       task->max_cycles / CYCLES_PER_US, task->late);
+	}
+
+	printf("yield(): %u calls, %" PRIu32 " min, %" PRIu32 " avg, %" PRIu32
+	       " max cycles\n",
+	       yield_stats.calls, yield_stats.min_cycles,
+	       yield_stats.calls ? (uint32_t)(yield_stats.sum_cycles /
+					      yield_stats.calls) : 0,
+	       yield_stats.max_cycles);
+}
+
+void task_reset_stats(void)
+{
+	struct task *task;
+	unsigned int i;
+	int prio;
+
+	for_each_task(task, prio, i) {
+		task->runs = task->overruns = task->skipped = 0;
+		task->min_cycles = task->max_cycles = 0;
+		task->sum_cycles = 0;
+		task->late = 0;
+	}
+
+	memset(&yield_stats, 0, sizeof(yield_stats));
+}
+
+/*
+ * Call func(data) once, after delay us.
+ * Returns a handle for task_timer_cancel(), or a negative value on failure.
+ */
+int task_timer_add(void (*func)(unsigned long data), unsigned long data,
+		   unsigned int delay)
+{
+	struct timer *timer;
+	unsigned int i;
+
+	for (i = 0; i < TIMER_MAX; i++) {
+		timer = &timers[i];
+		if (!timer->func)
+			goto found;
+	}
+
+	pr_err("Too many timers\n");
+	return -1;
+
+found:
+	timer->task.name = "timer";
+	timer->task.func = NULL;
+	timer->task.prio = TASK_PRIO_HIGH;
+	timer->task.period = delay;
+	timer->task.base = micros();
+	if (task_queue(&timer->task))
+		return -1;
+
+	timer->func = func;
+	timer->data = data;
+	timer_gen = (timer_gen + 1) & TIMER_GEN_MASK ?: 1;
+	timer->gen = timer_gen;
+	return timer->gen << TIMER_IDX_BITS | i;
+}
+
+/*
+ * Cancel a pending timer.
+ * Returns zero on success, or a negative value if the timer already expired.
+ */
+int task_timer_cancel(int handle)
+{
+	unsigned int i = handle & (BIT(TIMER_IDX_BITS) - 1);
+	struct timer *timer = &timers[i];
+
+	if (handle <= 0 || i >= TIMER_MAX || !timer->func ||
+	    timer->gen != handle >> TIMER_IDX_BITS)
+		return -1;
+
+	task_del(&timer->task);
+	timer->func = NULL;
+	return 0;
+}
+
+static void task_timer_run(struct task *task)
+{
+	struct timer *timer = (struct timer *)task;
+	void (*func)(unsigned long data) = timer->func;
+	unsigned long data = timer->data;
+
+	/* Release the timer first, so the callback can reuse it */
+	task_del(task);
+	timer->func = NULL;
+	func(data);
+}
+
+static void task_account_latency(uint32_t late)
+{
+	unsigned int i = late ? 32 - __builtin_clz(late) : 0;
+
+	if (i >= TASK_LATENCY_BUCKETS)
+		i = TASK_LATENCY_BUCKETS - 1;
+	task_latency[i]++;
+}
+
+void task_show_latency(void)
+{
+	unsigned int i, lo, hi;
+
+	printf("   Latency (us)        Count\n"
+	       "  ---------------  ----------\n");
+	for (i = 0; i < TASK_LATENCY_BUCKETS; i++) {
+		lo = i ? BIT(i - 1) : 0;
+		hi = i ? BIT(i) - 1 : 0;
+		if (i == TASK_LATENCY_BUCKETS - 1)
+			printf("  %6u-           %10u\n", lo, task_latency[i]);
+		else
+			printf("  %6u-%-6u     %10u\n", lo, hi, task_latency[i]);
+	}
+}
+
+void task_reset_latency(void)
+{
+	memset(task_latency, 0, sizeof(task_latency));
+}
+
+/* Advance the period of a task, according to its policy */
+static void task_advance(struct task *task, uint32_t start)
+{
+	uint32_t n;
+
+	if (!task->period) {
+		task->base = start;
+		return;
+	}
+
+	switch (task->policy) {
+	case TASK_CATCH_UP:
+		task->base += task->period;
+		break;
+
+	case TASK_SKIP_MISSED:
+		/* Next deadline is the first multiple of period in the future */
+		n = (micros() - task->base) / task->period;
+		task->base += n * task->period;
+		task->skipped += n - 1;
+		break;
+
+	case TASK_RESCHEDULE:
+		task->skipped += (start - task->base) / task->period - 1;
+		task->base = start;
+		break;
+	}
 }
 
-static void task_run(struct task *task)
+static void task_run(struct task *task, uint32_t late)
 {
-	struct task *prev, *next;
-	uint32_t now;
+	uint32_t start;
 	int error;
 
+	task_account_latency(late);
+
+	if (!task->func) {
+		task_timer_run(task);
+		return;
+	}
+
 	pr_debug("Running task %s\n", task->name);
 	/* Run task */
+	start = ARM_DWT_CYCCNT;
 	error = task->func();
+	task_account(task, late, ARM_DWT_CYCCNT - start);
 
-	pr_debug("Removing task %s from list\n", task->name);
-	/* Remove (always first) task from list */
-	task_del(task);
+	/* The task may have removed itself */
+	if (!task_queued(task))
+		return;
 
 	pr_debug("Checking for completion of task %s\n", task->name);
 	if (error) {
-		pr_info("Task %s stopped with error %d\n", task->name, error);
+		task_del(task);
+		if (error != TASK_DONE)
+			pr_info("Task %s stopped with error %d\n", task->name,
+				error);
 		return;
 	}
 
-	task->base += task->period;
-	pr_debug("Next run of task %s at %lu\n", task->name,
-		 task->base + task->period);
+	/* Completed after the nominal next deadline? */
+	if (task->period &&
+	    (int32_t)(micros() - task_deadline(task) - task->period) >= 0)
+		task->overruns++;
 
-	/* Enqueue task in list */
-	now = micros();
-	for (prev = NULL, next = tasks; next; prev = next, next = next->next) {
-		if ((int32_t)(task->base + task->period - now) <
-		    (int32_t)(next->base + next->period - now))
-			break;
+	task_advance(task, task_deadline(task) + late);
+	pr_debug("Next run of task %s at %" PRIu32 "\n", task->name,
+		 task_deadline(task));
+
+	/* The deadline can only move forward */
+	task_sift_down(task_heap(task), task->slot);
+}
+
+/*
+ * The wake-up timer uses PIT channel 3, which is not used by anything else
+ * (IntervalTimer allocates PIT channels from channel 0 upwards).
+ */
+void pit3_isr(void)
+{
+	PIT_TFLG3 = PIT_TFLG_TIF;
+}
+
+static void task_timer_init(void)
+{
+	/* Cycle counter for task statistics */
+	ARM_DEMCR |= ARM_DEMCR_TRCENA;
+	ARM_DWT_CTRL |= ARM_DWT_CTRL_CYCCNTENA;
+
+	SIM_SCGC6 |= SIM_SCGC6_PIT;
+	PIT_MCR = 0;
+	PIT_TCTRL3 = 0;
+	NVIC_ENABLE_IRQ(IRQ_PIT_CH3);
+}
+
+/*
+ * Received USB or UART data not yet handled by yield(), or work posted since
+ * the last work_run()?
+ */
+static int task_event_pending(void)
+{
+	return usb_rx_pending || serial_available() || serial2_available() ||
+	       work_pending();
+}
+
+/*
+ * Sleep in WAIT mode until the wake-up timer expires, or any other interrupt
+ * (USB, UART, SysTick, ...) happens.
+ *
+ * WFE is used instead of WFI, as exception entry and return set the event
+ * register: if an interrupt was handled (e.g. posting deferred work) after the
+ * caller checked for pending work, WFE returns immediately instead of
+ * sleeping until the next interrupt.
+ *
+ * Deeper sleep modes are not usable: VLPW needs the core to run at 4 MHz or
+ * less, and STOP modes stop the USB module. SysTick keeps on running, as
+ * millis() and micros() depend on it.
+ */
+static void task_sleep(uint32_t us)
+{
+	uint32_t start, end;
+
+	if (task_event_pending())
+		return;
+
+	if (us > HZ)
+		us = HZ;
+
+	PIT_LDVAL3 = us * (F_BUS / 1000000) - 1;
+	PIT_TFLG3 = PIT_TFLG_TIF;
+	PIT_TCTRL3 = PIT_TCTRL_TIE | PIT_TCTRL_TEN;
+
+	start = micros();
+#ifdef __arm__
+	asm volatile("wfe");
+#endif
+	end = micros();
+
+	PIT_TCTRL3 = 0;
+
+	/* The cycle counter stops during sleep, so use micros() */
+	idle_stats.busy_us += start - idle_stats.last;
+	idle_stats.idle_us += end - start;
+	idle_stats.last = end;
+	idle_stats.sleeps++;
+}
+
+/* Print a time in us as seconds with millisecond resolution */
+static void print_secs(const char *name, uint64_t us, uint64_t total)
+{
+	uint32_t ms = us / 1000;
+	uint32_t permille = total ? us * 1000 / total : 0;
+
+	printf("%-5s %7" PRIu32 ".%03" PRIu32 " s  %3" PRIu32 ".%" PRIu32 "%%\n",
+	       name, ms / 1000, ms % 1000, permille / 10, permille % 10);
+}
+
+void task_show_idle_stats(void)
+{
+	uint64_t busy = idle_stats.busy_us + (micros() - idle_stats.last);
+	uint64_t total = busy + idle_stats.idle_us;
+
+	print_secs("Busy", busy, total);
+	print_secs("Idle", idle_stats.idle_us, total);
+	printf("Sleeps %u\n", idle_stats.sleeps);
+}
+
+void task_reset_idle_stats(void)
+{
+	idle_stats.busy_us = idle_stats.idle_us = 0;
+	idle_stats.sleeps = 0;
+	idle_stats.last = micros();
+}
+
+/*
+ * Find the next task to run: a ready task of the highest priority level, or
+ * else the task with the nearest deadline.
+ * Returns NULL if there are no tasks, else sets *delta to the time (us) to
+ * the task's deadline.
+ */
+static struct task *task_next(int32_t *delta)
+{
+	struct task *task, *next = NULL;
+	uint32_t now = micros();
+	int prio;
+	int32_t d;
+
+	for (prio = TASK_PRIO_NUM - 1; prio >= 0; prio--) {
+		if (!heaps[prio].num)
+			continue;
+
+		task = heaps[prio].tasks[0];
+		d = (int32_t)(task_deadline(task) - now);
+		if (d <= 0) {
+			*delta = d;
+			return task;
+		}
+
+		if (!next || d < *delta) {
+			next = task;
+			*delta = d;
+		}
 	}
-	task->prev = prev;
-	task->next = next;
-	if (prev)
-		prev->next = task;
-	else
-		tasks = task;
-	if (next)
-		next->prev = task;
+
+	return next;
 }
 
 void task_run_loop(void)
 {
+	uint32_t start, cycles;
 	struct task *task;
-	uint32_t now;
+	int32_t delta;
 
-	while (tasks) {
-		task = tasks;
+	task_timer_init();
+	task_reset_idle_stats();
 
-		pr_debug("Waiting for %lu to run task %s\n",
-			 task->base + task->period, task->name);
-		while (1) {
-			now = micros();
-			if (now - task->base >= task->period)
-				break;
+	while (1) {
+		/* Service USB and UART events */
+		start = ARM_DWT_CYCCNT;
+		yield();
+		cycles = ARM_DWT_CYCCNT - start;
+		if (!yield_stats.calls || cycles < yield_stats.min_cycles)
+			yield_stats.min_cycles = cycles;
+		yield_stats.calls++;
+		yield_stats.sum_cycles += cycles;
+		if (cycles > yield_stats.max_cycles)
+			yield_stats.max_cycles = cycles;
 
-			delay(10);
+		/* Deferred work from interrupt handlers has priority */
+		if (work_run())
+			continue;
+
+		task = task_next(&delta);
+		if (!task)
+			break;
+
+		if (delta <= 0) {
+			task_run(task, -delta);
+			continue;
 		}
-		task_run(task);
+
+		/* Sleep until shortly before the deadline, spin for the rest */
+		if (delta > TASK_SPIN_US)
+			task_sleep(delta - TASK_SPIN_US);
 	}
 	pr_err("PANIC: No more tasks to run\n");
 }
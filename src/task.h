@@ -9,16 +9,60 @@
 
 #define HZ			1000000
 
+#define TASK_MAX		32	/* Maximum number of queued tasks */
+#define TIMER_MAX		16	/* Maximum number of pending timers */
+
+/*
+ * Task functions return zero to keep on running, TASK_DONE when finished,
+ * or a negative error code.
+ */
+#define TASK_DONE		1
+
+/* What to do when a periodic task has missed one or more deadlines */
+enum task_policy {
+	TASK_CATCH_UP,		// Run all missed periods back-to-back
+	TASK_SKIP_MISSED,	// Skip missed periods, keeping phase
+	TASK_RESCHEDULE,	// Restart the period from the actual start
+};
+
+/*
+ * Ready tasks of a higher priority level always run before ready tasks of a
+ * lower priority level. Within a level, tasks run in order of deadline.
+ */
+enum task_prio {
+	TASK_PRIO_LOW,		// Printing, LED effects, ...
+	TASK_PRIO_HIGH,		// Measurement, timers, ...
+	TASK_PRIO_NUM
+};
+
 struct task {
 	const char *name;
 	int (*func)(void);
 	unsigned int period;	// us
+	enum task_policy policy;
+	enum task_prio prio;	// must not be changed while queued
 	/* private */
 	uint32_t base;
-	struct task *prev;
-	struct task *next;
+	unsigned int slot;	// index in task heap
+	/* statistics */
+	unsigned int runs;
+	unsigned int overruns;	// runs completing after the next deadline
+	unsigned int skipped;	// periods skipped due to the policy
+	uint32_t min_cycles;
+	uint32_t max_cycles;
+	uint64_t sum_cycles;
+	uint32_t late;		// us, lateness of the last start
 };
 
 extern void task_add(struct task *task);
 extern void task_del(struct task *task);
+extern int task_timer_add(void (*func)(unsigned long data), unsigned long data,
+			  unsigned int delay);
+extern int task_timer_cancel(int handle);
 extern void task_run_loop(void);
+extern void task_show_stats(void);
+extern void task_reset_stats(void);
+extern void task_show_idle_stats(void);
+extern void task_reset_idle_stats(void);
+extern void task_show_latency(void);
+extern void task_reset_latency(void);
@@ -0,0 +1,89 @@
+//
+// Deferred Work Queue
+//
+// © Copyright 2026 Glider bv
+//
+// This file is subject to the terms and conditions of the GNU General Public
+// License, version 2.
+//
+
+#include "print.h"
+#include "work.h"
+
+/*
+ * Lock-free single-producer/single-consumer queue, to hand work from
+ * interrupt handlers to the main loop.
+ *
+ * The producer side (work_post()) may be called from interrupt handlers
+ * only, and all producers must run at the same interrupt priority, so they
+ * cannot preempt each other. The consumer side (work_run()) is called from
+ * the main loop only.
+ *
+ * head and tail are free-running, and only written by the producer resp.
+ * consumer.
+ */
+static struct work {
+	void (*func)(unsigned long data);
+	unsigned long data;
+} queue[WORK_MAX];
+static volatile unsigned int head, tail;
+
+/* Statistics */
+static volatile unsigned int work_posted, work_dropped, work_max_depth;
+
+int work_post(void (*func)(unsigned long data), unsigned long data)
+{
+	unsigned int h = head, depth = h - tail;
+	struct work *work;
+
+	if (depth >= WORK_MAX) {
+		work_dropped++;
+		return -1;
+	}
+
+	work = &queue[h % WORK_MAX];
+	work->func = func;
+	work->data = data;
+	/* Make sure the entry is visible before publishing it */
+	__sync_synchronize();
+	head = h + 1;
+
+	work_posted++;
+	if (++depth > work_max_depth)
+		work_max_depth = depth;
+	return 0;
+}
+
+int work_pending(void)
+{
+	return head != tail;
+}
+
+/* Run all pending work, return the number of work items run */
+unsigned int work_run(void)
+{
+	unsigned int n = 0, t;
+	struct work work;
+
+	while ((t = tail) != head) {
+		__sync_synchronize();
+		work = queue[t % WORK_MAX];
+		/* Release the entry before running, so it can be reposted */
+		tail = t + 1;
+		work.func(work.data);
+		n++;
+	}
+
+	return n;
+}
+
+void work_show_stats(void)
+{
+	printf("Work queue: %u posted, %u dropped, %u/%u max depth\n",
+	       work_posted, work_dropped, work_max_depth, WORK_MAX);
+}
+
+void work_reset_stats(void)
+{
+	work_posted = work_dropped = work_max_depth = 0;
+}
@@ -0,0 +1,16 @@
+//
+// Deferred Work Queue
+//
+// © Copyright 2026 Glider bv
+//
+// This file is subject to the terms and conditions of the GNU General Public
+// License, version 2.
+//
+
+#define WORK_MAX		32	/* Queue size, must be a power of two */
+
+extern int work_post(void (*func)(unsigned long data), unsigned long data);
+extern unsigned int work_run(void);
+extern int work_pending(void);
+extern void work_show_stats(void);
+extern void work_reset_stats(void);
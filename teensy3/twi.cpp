@@ -1,9 +1,143 @@
+// Replaced by src/ina219sim.c in simulator builds
+#ifndef INA219_SIM
+
+#include <errno.h>
+
 #include "twi.h"
 #include "i2c_t3.h"
 
+// Maximum duration of a non-blocking transfer (µs)
+#define TWI_ASYNC_TIMEOUT	10000
+
+/*
+ * Non-blocking register reads: for each register, write the register
+ * pointer, and read the register after a repeated START.  All registers are
+ * read in a single transaction, using repeated STARTs, driven by the i2c_t3
+ * interrupt callbacks.
+ */
+enum twi_async_state {
+	TWI_ASYNC_IDLE,
+	TWI_ASYNC_POINTER,	// Writing register pointer
+	TWI_ASYNC_READ,		// Reading register
+};
+
+static struct {
+	volatile uint8_t state;
+	uint8_t address;
+	const uint8_t *regs;
+	uint8_t n;		// Number of registers
+	uint8_t i;		// Register being read
+	uint8_t length;		// Bytes per register
+	uint8_t *data;
+	void (*done)(int res);
+} twi_async;
+
+static volatile int twi_sync_res;
+
+static void twi_async_finish(int res)
+{
+	void (*done)(int res) = twi_async.done;
+
+	twi_async.state = TWI_ASYNC_IDLE;
+	done(res);
+}
+
+static void twi_async_pointer(void)
+{
+	twi_async.state = TWI_ASYNC_POINTER;
+	Wire.beginTransmission(twi_async.address);
+	Wire.write(twi_async.regs[twi_async.i]);
+	Wire.sendTransmission(I2C_NOSTOP);
+}
+
+static void twi_async_tx_done(void)
+{
+	int last = twi_async.i == twi_async.n - 1;
+
+	if (twi_async.state != TWI_ASYNC_POINTER)
+		return;
+
+	twi_async.state = TWI_ASYNC_READ;
+	Wire.sendRequest(twi_async.address, twi_async.length,
+			 last ? I2C_STOP : I2C_NOSTOP);
+}
+
+static void twi_async_rx_done(void)
+{
+	size_t n;
+
+	if (twi_async.state != TWI_ASYNC_READ)
+		return;
+
+	n = Wire.read(twi_async.data + twi_async.i * twi_async.length,
+		      twi_async.length);
+	if (n != twi_async.length) {
+		twi_async_finish(-EIO);
+		return;
+	}
+
+	if (++twi_async.i < twi_async.n)
+		twi_async_pointer();
+	else
+		twi_async_finish(twi_async.n * twi_async.length);
+}
+
+static void twi_sync_done(int res)
+{
+	twi_sync_res = res;
+}
+
+static void twi_async_error(void)
+{
+	uint8_t status;
+
+	if (twi_async.state == TWI_ASYNC_IDLE)
+		return;
+
+	// Don't let a missing status pass for success, or a timeout for
+	// something else
+	status = Wire.getError();
+	if (status == I2C_WAITING)
+		twi_async_finish(-EIO);
+	else if (status == I2C_TIMEOUT)
+		twi_async_finish(-ETIMEDOUT);
+	else
+		twi_async_finish(-(int)status);
+}
+
+/*
+ * Wait for completion of a pending non-blocking transfer, aborting it if it
+ * takes too long
+ */
+void twi_asyncWait(void)
+{
+	uint32_t start = micros();
+
+	while (twi_async.state != TWI_ASYNC_IDLE) {
+		if (micros() - start > TWI_ASYNC_TIMEOUT) {
+			twi_asyncAbort();
+			return;
+		}
+	}
+}
+
 void twi_init(void)
 {
 	Wire.begin();
+	Wire.onTransmitDone(twi_async_tx_done);
+	Wire.onReqFromDone(twi_async_rx_done);
+	Wire.onError(twi_async_error);
+}
+
+void twi_setFrequency(uint32_t frequency)
+{
+	twi_asyncWait();
+	Wire.setClock(frequency);
+}
+
+uint32_t twi_getFrequency(void)
+{
+	return Wire.getClock();
 }
 
 uint8_t twi_readFrom(uint8_t address, uint8_t *data, uint8_t length,
@@ -12,6 +146,7 @@ uint8_t twi_readFrom(uint8_t address, uint8_t *data, uint8_t length,
 	unsigned int i;
 	size_t n;
 
+	twi_asyncWait();
 	n = Wire.requestFrom(address, length, sendStop ? I2C_STOP : I2C_NOSTOP,
 			     1000000);
 	if (!n)
@@ -28,12 +163,88 @@ uint8_t twi_writeTo(uint8_t address, uint8_t *data, uint8_t length,
 {
 	unsigned int i = 0;
 
+	twi_asyncWait();
 	Wire.beginTransmission(address);
 	for (i = 0; i < length; i++)
 		Wire.write(data[i]);
 	return Wire.endTransmission(sendStop ? I2C_STOP : I2C_NOSTOP, 1000000);
 }
 
+/*
+ * Start reading length bytes from each of the n registers in regs of the
+ * device at address, into data.  regs must stay valid until completion.
+ * On completion, done() is called, typically from interrupt context, with
+ * the total number of bytes read, or a negative error code: -EIO for a
+ * short read, -ETIMEDOUT for a timeout or an aborted transfer, or the
+ * negated i2c_status otherwise (e.g. -I2C_ADDR_NAK).
+ * Returns zero if the transfer was started, or -1 if the bus is busy.
+ */
+int twi_readRegistersAsync(uint8_t address, const uint8_t *regs, uint8_t n,
+			   uint8_t *data, uint8_t length, void (*done)(int res))
+{
+	if (twi_async.state != TWI_ASYNC_IDLE)
+		return -1;
+
+	twi_async.address = address;
+	twi_async.regs = regs;
+	twi_async.n = n;
+	twi_async.i = 0;
+	twi_async.length = length;
+	twi_async.data = data;
+	twi_async.done = done;
+	twi_async_pointer();
+	return 0;
+}
+
+/* Blocking variant of twi_readRegistersAsync() */
+int twi_readRegisters(uint8_t address, const uint8_t *regs, uint8_t n,
+		      uint8_t *data, uint8_t length)
+{
+	twi_asyncWait();
+	twi_sync_res = -EBUSY;
+	if (twi_readRegistersAsync(address, regs, n, data, length,
+				   twi_sync_done))
+		return -EBUSY;
+
+	twi_asyncWait();
+	return twi_sync_res;
+}
+
+uint8_t twi_asyncBusy(void)
+{
+	return twi_async.state != TWI_ASYNC_IDLE;
+}
+
+/*
+ * Give up on a non-blocking transfer that did not complete, e.g. due to a
+ * stuck bus, as i2c_t3 does not support timeouts in non-blocking mode.
+ * The bus is recovered by clocking out a slave that may be holding SDA low,
+ * and the controller is reinitialized, as it may still be in the middle of
+ * the transfer.  done() is called with -ETIMEDOUT.
+ */
+void twi_asyncAbort(void)
+{
+	uint32_t rate;
+	uint8_t state;
+
+	__disable_irq();
+	state = twi_async.state;
+	twi_async.state = TWI_ASYNC_IDLE;
+	__enable_irq();
+
+	if (state == TWI_ASYNC_IDLE)
+		return;
+
+	rate = Wire.getClock();
+	Wire.resetBus();
+	Wire.begin();
+	Wire.setClock(rate);
+
+	twi_async.done(-ETIMEDOUT);
+}
+
 void twi_stop(void)
 {
 }
+
+#endif /* !INA219_SIM */
@@ -51,6 +51,15 @@ extern "C" {
 	void twi_reply(uint8_t);
 	void twi_stop(void);
 	void twi_releaseBus(void);
+	void twi_setFrequency(uint32_t);
+	uint32_t twi_getFrequency(void);
+	int twi_readRegistersAsync(uint8_t, const uint8_t*, uint8_t, uint8_t*,
+				   uint8_t, void (*)(int));
+	int twi_readRegisters(uint8_t, const uint8_t*, uint8_t, uint8_t*,
+			      uint8_t);
+	uint8_t twi_asyncBusy(void);
+	void twi_asyncWait(void);
+	void twi_asyncAbort(void);
 #ifdef __cplusplus
 };
 #endif
@@ -72,6 +72,7 @@ static usb_packet_t *rx_last[NUM_ENDPOINTS];
 static usb_packet_t *tx_first[NUM_ENDPOINTS];
 static usb_packet_t *tx_last[NUM_ENDPOINTS];
 uint16_t usb_rx_byte_count_data[NUM_ENDPOINTS];
+volatile uint32_t usb_rx_pending;
 
 static uint8_t tx_state[NUM_ENDPOINTS];
 #define TX_STATE_BOTH_FREE_EVEN_FIRST	0
@@ -1072,6 +1073,7 @@ void usb_isr(void)
 					}
 					rx_last[endpoint] = packet;
 					usb_rx_byte_count_data[endpoint] += packet->len;
+					usb_rx_pending |= 1UL << endpoint;
 					// TODO: implement a per-endpoint maximum # of allocated
 					// packets, so a flood of incoming data on 1 endpoint
 					// doesn't starve the others if the user isn't reading
@@ -59,6 +59,9 @@ void usb_tx_isochronous(uint32_t endpoint, void *data, uint32_t len);
 extern volatile uint8_t usb_configuration;
 
 extern uint16_t usb_rx_byte_count_data[NUM_ENDPOINTS];
+// Bitmask of endpoints (bit 0 = endpoint 1) with newly received data, set by
+// usb_isr(), to be cleared by the consumer
+extern volatile uint32_t usb_rx_pending;
 static inline uint32_t usb_rx_byte_count(uint32_t endpoint) __attribute__((always_inline));
 static inline uint32_t usb_rx_byte_count(uint32_t endpoint)
 {
@@ -61,6 +61,7 @@ extern struct usb_serial_port usb_serial_ports[];
 
 extern volatile uint32_t systick_millis_count;
 extern volatile uint8_t usb_configuration;
+extern volatile uint32_t usb_rx_pending;
 
 int __usb_serial_getchar(struct usb_serial_port *port);
 int __usb_serial_peekchar(struct usb_serial_port *port);
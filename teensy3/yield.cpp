@@ -31,6 +31,34 @@
 #include <Arduino.h>
 #include "EventResponder.h"
 
+#if defined(USB_SERIAL) || defined(USB_DUAL_SERIAL) || defined(USB_TRIPLE_SERIAL)
+// Test and clear the pending receive event of a USB serial port
+static inline int usb_serial_event_pending(unsigned int i)
+{
+	uint32_t mask = 1UL << (usb_serial_ports[i].cdc_rx_endpoint - 1);
+
+	if (!(usb_rx_pending & mask)) return 0;
+	__disable_irq();
+	usb_rx_pending &= ~mask;
+	__enable_irq();
+	return 1;
+}
+
+// Re-flag a USB serial port if its event handler left data behind
+static inline void usb_serial_event_repend(unsigned int i)
+{
+	uint32_t mask = 1UL << (usb_serial_ports[i].cdc_rx_endpoint - 1);
+
+	__disable_irq();
+	usb_rx_pending |= mask;
+	__enable_irq();
+}
+#endif
+
+// Only USB serial ports with receive events flagged by usb_isr() are checked,
+// as available() walks the packet queue with interrupts disabled.
+// Only the UARTs used by the BCU/2 (Serial1 and Serial2) are polled, which
+// is cheap (comparing buffer head and tail).
 void yield(void) __attribute__ ((weak));
 void yield(void)
 {
@@ -38,25 +66,26 @@ void yield(void)
 
 	if (running) return; // TODO: does this need to be atomic?
 	running = 1;
-	if (Serial.available()) serialEvent();
+#if defined(USB_SERIAL) || defined(USB_DUAL_SERIAL) || defined(USB_TRIPLE_SERIAL)
+	if (usb_serial_event_pending(0)) {
+		serialEvent();
+		if (Serial.available()) usb_serial_event_repend(0);
+	}
+#endif
 #if defined(USB_DUAL_SERIAL) || defined(USB_TRIPLE_SERIAL)
-	if (SerialUSB1.available()) serialEventUSB1();
+	if (usb_serial_event_pending(1)) {
+		serialEventUSB1();
+		if (SerialUSB1.available()) usb_serial_event_repend(1);
+	}
 #endif
 #ifdef USB_TRIPLE_SERIAL
-	if (SerialUSB2.available()) serialEventUSB2();
+	if (usb_serial_event_pending(2)) {
+		serialEventUSB2();
+		if (SerialUSB2.available()) usb_serial_event_repend(2);
+	}
 #endif
 	if (Serial1.available()) serialEvent1();
 	if (Serial2.available()) serialEvent2();
-	if (Serial3.available()) serialEvent3();
-#ifdef HAS_KINETISK_UART3
-	if (Serial4.available()) serialEvent4();
-#endif
-#ifdef HAS_KINETISK_UART4
-	if (Serial5.available()) serialEvent5();
-#endif
-#if defined(HAS_KINETISK_UART5) || defined (HAS_KINETISK_LPUART0)
-	if (Serial6.available()) serialEvent6();
-#endif
 	running = 0;
 	EventResponder::runFromYield();
 };
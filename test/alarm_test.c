@@ -0,0 +1,154 @@
+//
+// Power Alarm Tests
+//
+// © Copyright 2026 Glider bv
+//
+// This file is subject to the terms and conditions of the GNU General Public
+// License, version 2.
+//
+
+#include <stdio.h>
+#include <string.h>
+#include <WProgram.h>
+
+#include "alarm.h"
+#include "board.h"
+#include "capture.h"
+#include "cmd.h"
+#include "host.h"
+#include "ina219.h"
+#include "task.h"
+
+/* Simplified conversions: 100 µA per shunt LSB, bus in mV */
+int ina219_bus_mV(unsigned int ch, const struct ina219_raw *raw)
+{
+	return raw->bus;
+}
+
+int ina219_current_uA(unsigned int ch, const struct ina219_raw *raw)
+{
+	return raw->shunt * 100;
+}
+
+int ina219_power_uW(unsigned int ch, const struct ina219_raw *raw)
+{
+	return (int64_t)raw->shunt * 100 * raw->bus / 1000;
+}
+
+static unsigned int capture_offs;
+
+void capture_power(unsigned int ch, int state)
+{
+	if (!state)
+		capture_offs++;
+}
+
+static void power_on(unsigned int ch)
+{
+	digitalWrite(pin_power[ch], 1);
+	alarm_power(ch, 1);
+}
+
+/* The hold-off time restarts when the current drops below the limit */
+static void test_holdoff(void)
+{
+	static char params[] = "imax=500,vmin=4500,hold=2";
+	static char *argv[] = { params };
+	struct ina219_raw raw = { .shunt = 4000, .bus = 5000 };	/* 400 mA */
+	uint32_t t;
+
+	CHECK(!alarm_config(0, 1, argv));
+	power_on(0);
+
+	for (t = 0; t < 10000; t += 500)
+		alarm_check(0, t, &raw);
+	CHECK(!alarm_tripped(0));
+
+	raw.shunt = 6000;
+	alarm_check(0, 10000, &raw);
+	raw.shunt = 9000;
+	alarm_check(0, 11000, &raw);
+	raw.shunt = 4000;
+	alarm_check(0, 11500, &raw);
+	raw.shunt = 7000;
+	alarm_check(0, 12000, &raw);
+	alarm_check(0, 13000, &raw);
+	CHECK(!alarm_tripped(0));
+	CHECK(host_pins[pin_power[0]]);
+
+	alarm_check(0, 14000, &raw);
+	CHECK(alarm_tripped(0));
+	CHECK(!host_pins[pin_power[0]]);
+
+	/* Under-voltage */
+	power_on(0);
+	raw.shunt = 0;
+	raw.bus = 100;
+	alarm_check(0, 20000, &raw);
+	alarm_check(0, 22000, &raw);
+	CHECK(alarm_tripped(0));
+
+	/* Channel B has no limits configured */
+	power_on(1);
+	alarm_check(1, 0, &raw);
+	alarm_check(1, 5000, &raw);
+	CHECK(!alarm_tripped(1));
+	alarm_power(1, 0);
+
+	host_run(0);
+	alarm_clear();
+}
+
+/*
+ * Trips are handled and reported from deferred work, but never reported into
+ * a stream or the output of a background command
+ */
+static void test_report(void)
+{
+	static char params[] = "pmax=100,hold=0";
+	static char *argv[] = { params };
+	struct ina219_raw raw = { .shunt = 300, .bus = 5000 };	/* 150 mW */
+
+	CHECK(!alarm_config(1, 1, argv));
+	power_on(1);
+
+	host_output_clear();
+	host_power_cuts = capture_offs = 0;
+	alarm_check(1, 30000, &raw);
+	CHECK(alarm_tripped(1));
+	CHECK(!host_pins[pin_power[1]]);
+	CHECK(!strstr(host_output, "Alarm"));
+	CHECK(!host_power_cuts && !capture_offs);
+
+	host_run(0);
+	CHECK(strstr(host_output, "Alarm B: over-power"));
+	CHECK(host_power_cuts == 2 && capture_offs == 1);
+
+	/* Nothing new, nothing to report */
+	host_output_clear();
+	host_run(HZ);
+	CHECK(!host_output[0]);
+
+	cmd_mode = CMD_STREAM;
+	power_on(1);
+	alarm_check(1, 40000, &raw);
+	host_run(HZ);
+	CHECK(!host_output[0]);
+
+	cmd_mode = CMD_BUSY;
+	host_run(HZ);
+	CHECK(!host_output[0]);
+
+	cmd_mode = CMD_COMMAND;
+	host_run(HZ / 10);
+	CHECK(strstr(host_output, "Alarm B: over-power"));
+}
+
+int main(void)
+{
+	alarm_init();
+	test_holdoff();
+	test_report();
+	puts("alarm_test: ok");
+	return 0;
+}
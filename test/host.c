@@ -0,0 +1,135 @@
+//
+// Host Replacement for the Teensy Core
+//
+// © Copyright 2026 Glider bv
+//
+// This file is subject to the terms and conditions of the GNU General Public
+// License, version 2.
+//
+
+#include <stdarg.h>
+#include <stdio.h>
+
+#include "cmd.h"
+#include "host.h"
+#include "print.h"
+
+uint32_t host_us;
+volatile uint32_t host_regs[16];
+volatile uint32_t usb_rx_pending;
+uint8_t host_pins[HOST_NUM_PINS];
+char host_output[4096];
+size_t host_output_len;
+
+int cmd_mode;
+unsigned int host_power_cuts;
+
+/* Set HOST_VERBOSE in the environment to see the firmware's output */
+static int host_verbose = -1;
+
+uint32_t micros(void)
+{
+	return host_us;
+}
+
+uint32_t millis(void)
+{
+	return host_us / 1000;
+}
+
+void delay(uint32_t ms)
+{
+	host_us += ms * 1000;
+}
+
+void delayMicroseconds(uint32_t us)
+{
+	host_us += us;
+}
+
+void yield(void)
+{
+}
+
+void pinMode(uint8_t pin, uint8_t mode)
+{
+}
+
+void digitalWrite(uint8_t pin, uint8_t val)
+{
+	if (pin < HOST_NUM_PINS)
+		host_pins[pin] = !!val;
+}
+
+int serial_available(void)
+{
+	return 0;
+}
+
+int serial2_available(void)
+{
+	return 0;
+}
+
+int usb_serial_putchar(uint8_t c)
+{
+	return usb_serial_printf("%c", c);
+}
+
+int usb_serial_printf(const char *fmt, ...)
+{
+	size_t size = sizeof(host_output) - host_output_len;
+	va_list ap;
+	int n;
+
+	va_start(ap, fmt);
+	n = vsnprintf(host_output + host_output_len, size, fmt, ap);
+	va_end(ap);
+	host_output_len += n < size ? n : size - 1;
+
+	if (host_verbose < 0)
+		host_verbose = !!getenv("HOST_VERBOSE");
+	if (host_verbose) {
+		va_start(ap, fmt);
+		vprintf(fmt, ap);
+		va_end(ap);
+	}
+	return n;
+}
+
+int usb_serial_write(const void *buffer, uint32_t size)
+{
+	CHECK(size <= usb_serial_write_buffer_free());
+	memcpy(host_output + host_output_len, buffer, size);
+	host_output_len += size;
+	host_output[host_output_len] = '\0';
+	return size;
+}
+
+int usb_serial_write_buffer_free(void)
+{
+	return sizeof(host_output) - host_output_len - 1;
+}
+
+void host_output_clear(void)
+{
+	host_output[0] = '\0';
+	host_output_len = 0;
+}
+
+/* Background command completed */
+void cmd_done(void)
+{
+	cmd_mode = CMD_COMMAND;
+}
+
+void cmd_power_cut(unsigned int ch)
+{
+	host_power_cuts |= 1 << ch;
+}
+
+void host_fail(const char *file, int line, const char *expr)
+{
+	fprintf(stderr, "%s:%d: check failed: %s\n", file, line, expr);
+	exit(1);
+}
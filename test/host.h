@@ -0,0 +1,39 @@
+//
+// Host Test Helpers
+//
+// © Copyright 2026 Glider bv
+//
+// This file is subject to the terms and conditions of the GNU General Public
+// License, version 2.
+//
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Unlike assert(), this cannot be compiled out */
+#define CHECK(expr)							\
+	do {								\
+		if (!(expr))						\
+			host_fail(__FILE__, __LINE__, #expr);		\
+	} while (0)
+
+extern void host_fail(const char *file, int line, const char *expr)
+	__attribute__((__noreturn__));
+
+#define HOST_NUM_PINS		64
+
+/* Pin levels set by digitalWrite() */
+extern uint8_t host_pins[HOST_NUM_PINS];
+
+/* Power channels reported to be switched off behind the command's back */
+extern unsigned int host_power_cuts;
+
+/*
+ * Everything printed or written to the USB serial port by the firmware since
+ * the last host_output_clear(), always NUL-terminated
+ */
+extern char host_output[];
+extern size_t host_output_len;
+extern void host_output_clear(void);
+
+extern void host_run(uint32_t us);
@@ -0,0 +1,43 @@
+//
+// Host Scheduler Driver
+//
+// © Copyright 2026 Glider bv
+//
+// This file is subject to the terms and conditions of the GNU General Public
+// License, version 2.
+//
+
+#include "host.h"
+
+/* Include the implementation, to get at task_next() and task_run() */
+#include "../src/task.c"
+
+/*
+ * Run deferred work and due tasks, like task_run_loop() does, while advancing
+ * time by us.  Sleeps are skipped by jumping straight to the next deadline.
+ */
+void host_run(uint32_t us)
+{
+	uint32_t end = host_us + us;
+	struct task *task;
+	int32_t delta;
+
+	while (1) {
+		if (work_run())
+			continue;
+
+		task = task_next(&delta);
+		if (task && delta <= 0) {
+			task_run(task, -delta);
+			continue;
+		}
+
+		if (!task || (int32_t)(end - host_us) < delta)
+			break;
+		host_us += delta;
+	}
+
+	/* A task may have run past the end, time doesn't go back */
+	if ((int32_t)(end - host_us) > 0)
+		host_us = end;
+}
@@ -0,0 +1,88 @@
+//
+// INA219 Driver Benchmark, against the INA219 Simulator
+//
+// © Copyright 2026 Glider bv
+//
+// This file is subject to the terms and conditions of the GNU General Public
+// License, version 2.
+//
+
+#include <stdio.h>
+#include <string.h>
+#include <twi.h>
+
+#include "cmd.h"
+#include "host.h"
+#include "ina219.h"
+#include "ina219sim.h"
+#include "task.h"
+
+/*
+ * Runs "sim bench", and fails if reading a sample set the way the
+ * acquisition does costs more than half the I2C transactions or bus time of
+ * reading all result registers, the way the driver read samples before, so
+ * driver changes that cost bus time don't go unnoticed.
+ */
+#define BENCH_FREQ		400000
+#define BENCH_SETS		1000
+#define BENCH_CHANNELS		3	/* The simulator's default devices */
+
+/*
+ * Baseline per channel: a pointer write (20 bits) and a 2-byte read
+ * (29 bits) for each of the four result registers
+ */
+#define BENCH_BASE_XFERS	(8 * BENCH_CHANNELS)
+#define BENCH_BASE_US		(4 * (20 + 29) * BENCH_CHANNELS * 1000000 / \
+				 BENCH_FREQ)
+
+struct bench_cost {
+	unsigned int xfers, xfers_frac, bytes, bytes_frac, bus_us;
+};
+
+static void bench_parse(const char *name, struct bench_cost *c)
+{
+	const char *s = strstr(host_output, name);
+
+	CHECK(s && sscanf(s + strlen(name), "%u.%u %u.%u %u", &c->xfers,
+			  &c->xfers_frac, &c->bytes, &c->bytes_frac,
+			  &c->bus_us) == 5);
+}
+
+int main(void)
+{
+	unsigned int sets, num_ch, errors, ch;
+	struct bench_cost acquire, all;
+
+	twi_init();
+	twi_setFrequency(BENCH_FREQ);
+	CHECK(ina219_probe(2) == BENCH_CHANNELS);
+	for (ch = 0; ch < BENCH_CHANNELS; ch++)
+		CHECK(!ina219_init(ch, &ina219_default_params));
+
+	host_output_clear();
+	ina219_sim_bench(BENCH_SETS);
+	CHECK(cmd_mode == CMD_BUSY);
+	while (cmd_mode == CMD_BUSY)
+		host_run(HZ / 100);
+
+	fwrite(host_output, 1, host_output_len, stdout);
+	CHECK(sscanf(host_output, "%u sample sets of %u channels, %u errors",
+		     &sets, &num_ch, &errors) == 3);
+	CHECK(sets == BENCH_SETS && num_ch == BENCH_CHANNELS && !errors);
+
+	bench_parse("Acquisition", &acquire);
+	bench_parse("All registers", &all);
+	/* The simulator must agree with the baseline */
+	CHECK(all.xfers == BENCH_BASE_XFERS && !all.xfers_frac);
+	CHECK(all.bus_us == BENCH_BASE_US);
+
+	if (acquire.xfers * 100 + acquire.xfers_frac > BENCH_BASE_XFERS * 50 ||
+	    acquire.bus_us > BENCH_BASE_US / 2) {
+		fprintf(stderr, "ina219_bench: regression, expected at most %u transactions and %u us bus time per sample set\n",
+			BENCH_BASE_XFERS / 2, BENCH_BASE_US / 2);
+		return 1;
+	}
+
+	puts("ina219_bench: ok");
+	return 0;
+}
@@ -0,0 +1,262 @@
+//
+// INA219 Driver Tests, against the INA219 Simulator
+//
+// © Copyright 2026 Glider bv
+//
+// This file is subject to the terms and conditions of the GNU General Public
+// License, version 2.
+//
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "host.h"
+#include "ina219sim.h"
+
+/* Include the implementation, to get at the devices and error counts */
+#include "../src/ina219.c"
+
+#define TEST_FREQ		400000
+
+static int async_res;
+static unsigned int async_done_num;
+
+static void async_done(unsigned int ch, int error)
+{
+	async_res = error;
+	async_done_num++;
+}
+
+static void timer_nop(unsigned long data)
+{
+}
+
+/* Transactions on the simulated bus since the last call */
+static unsigned int sim_xfers(void)
+{
+	unsigned int xfers;
+
+	host_output_clear();
+	ina219_sim_show_stats();
+	CHECK(sscanf(host_output, "%u transactions", &xfers) == 1);
+	ina219_sim_reset_stats();
+	return xfers;
+}
+
+static void sim_config(int addr, const char *params)
+{
+	char buf[64], *argv[] = { buf };
+
+	snprintf(buf, sizeof(buf), "%s", params);
+	CHECK(!ina219_sim_config(addr, 1, argv));
+}
+
+static void test_probe(void)
+{
+	unsigned int ch;
+
+	twi_init();
+	twi_setFrequency(TEST_FREQ);
+
+	/* 0x40 and 0x41 are fixed, 0x44 is found, 0x43 is something else */
+	sim_config(0x43, "present=1,foreign=1");
+	CHECK(ina219_probe(2) == 3);
+	CHECK(ina219_dev[2].addr == 0x44);
+	sim_config(0x43, "present=0");
+
+	for (ch = 0; ch < 3; ch++)
+		CHECK(!ina219_init(ch, &ina219_default_params));
+}
+
+static void test_configure(void)
+{
+	struct ina219_params params = ina219_default_params;
+	uint16_t config = ina219_dev[0].config;
+	struct ina219_raw raw;
+
+	/* 320 mV at 3.2 A, the largest shunt voltage range */
+	params.max_mA = 3200;
+	CHECK(!ina219_configure(0, &params));
+	CHECK((ina219_dev[0].config & INA219_CFG_GAIN_MASK) ==
+	      INA219_CFG_GAIN_8);
+	params.max_mA = 400;
+	CHECK(!ina219_configure(0, &params));
+	CHECK((ina219_dev[0].config & INA219_CFG_GAIN_MASK) ==
+	      INA219_CFG_GAIN_1);
+
+	/* Out of range, the configuration is kept */
+	params.max_mA = 3201;
+	CHECK(ina219_configure(0, &params) < 0);
+	params.max_mA = 100;
+	params.shunt_mohm = 3201;
+	CHECK(ina219_configure(0, &params) < 0);
+	params.shunt_mohm = 0;
+	CHECK(ina219_configure(0, &params) < 0);
+	CHECK(ina219_dev[0].config == (config & ~INA219_CFG_GAIN_MASK));
+
+	/* Full scale power at the largest current still fits */
+	params.shunt_mohm = 3;
+	params.max_mA = 32001;
+	CHECK(ina219_configure(0, &params) < 0);
+	params.max_mA = 32000;
+	CHECK(!ina219_configure(0, &params));
+	CHECK((ina219_dev[0].config & INA219_CFG_GAIN_MASK) ==
+	      INA219_CFG_GAIN_4);
+	raw.shunt = 16000;	/* 160 mV */
+	raw.bus = 8191 << 3;	/* 32.764 V */
+	CHECK(ina219_current_uA(0, &raw) > 53000000);
+	CHECK(ina219_power_uW(0, &raw) > 1740000000);
+
+	CHECK(!ina219_configure(0, &ina219_default_params));
+	CHECK(ina219_dev[0].config == config);
+}
+
+/* 5 V at 100 mA, as configured by default */
+static void test_read_all(void)
+{
+	struct ina219_raw raw;
+
+	sim_xfers();
+	CHECK(!ina219_read_all(0, &raw));
+	CHECK(ina219_bus_mV(0, &raw) == 5000);
+	CHECK(ina219_shunt_uV(0, &raw) == 10000);
+	CHECK(ina219_current_uA(0, &raw) >= 99000);
+	CHECK(ina219_current_uA(0, &raw) <= 101000);
+	CHECK(ina219_power_uW(0, &raw) >= 495000);
+	CHECK(ina219_power_uW(0, &raw) <= 505000);
+
+	/* A pointer write and a register read per register */
+	CHECK(sim_xfers() == 2 * ARRAY_SIZE(ina219_regs_all));
+	CHECK(ina219_dev[0].pointer == INA219_POWER);
+
+	/* Negative currents */
+	sim_config(0x41, "ilo=-200");
+	CHECK(!ina219_read_all(1, &raw));
+	CHECK(ina219_current_uA(1, &raw) <= -199000);
+	CHECK(ina219_current_uA(1, &raw) >= -201000);
+	CHECK(ina219_power_uW(1, &raw) < 0);
+	sim_config(0x41, "ilo=100");
+}
+
+/* Non-blocking reads complete after the bus time, and update the cache */
+static void test_read_async(void)
+{
+	struct ina219_raw raw = { };
+	int timers[TIMER_MAX];
+	unsigned int i;
+
+	async_done_num = 0;
+	CHECK(!ina219_read_async(2, &raw, async_done));
+	CHECK(twi_asyncBusy());
+	CHECK(ina219_dev[2].pointer == INA219_POINTER_UNKNOWN);
+	/* Only one transfer at a time */
+	CHECK(ina219_read_async(1, &raw, async_done) < 0);
+
+	host_run(1000);
+	CHECK(async_done_num == 1 && !async_res);
+	CHECK(!twi_asyncBusy());
+	CHECK(ina219_bus_mV(2, &raw) == 5000);
+	CHECK(ina219_dev[2].pointer == INA219_BUS_V);
+
+	/* Rereading a register doesn't rewrite the pointer */
+	sim_xfers();
+	CHECK(ina219_read(2, INA219_BUS_V) == raw.bus);
+	CHECK(sim_xfers() == 1);
+
+	/* Unless a non-blocking read moved it in the meantime */
+	CHECK(ina219_read(2, INA219_CFG) == ina219_dev[2].config);
+	CHECK(!ina219_read_async(2, &raw, async_done));
+	CHECK(ina219_read(2, INA219_CFG) == ina219_dev[2].config);
+	CHECK(async_done_num == 2 && !async_res);
+	CHECK(ina219_dev[2].pointer == INA219_CFG);
+
+	/* Completions don't need a timer, when all are in use */
+	for (i = 0; i < TIMER_MAX; i++)
+		CHECK((timers[i] = task_timer_add(timer_nop, 0, HZ)) > 0);
+	CHECK(!ina219_read_async(2, &raw, async_done));
+	/* Shunt and bus voltage, 2 x (20 + 29) bits at TEST_FREQ */
+	host_run(240);
+	CHECK(async_done_num == 2);
+	host_run(10);
+	CHECK(async_done_num == 3 && !async_res);
+	for (i = 0; i < TIMER_MAX; i++)
+		CHECK(!task_timer_cancel(timers[i]));
+}
+
+static void test_errors(void)
+{
+	struct ina219_errors *e = &ina219_errors[1];
+	struct ina219_raw raw;
+
+	ina219_reset_stats();
+
+	/* With the register pointer cached, only the read is NACKed */
+	CHECK(ina219_read(1, INA219_CFG) >= 0);
+	sim_config(0x41, "present=0");
+	CHECK(ina219_read(1, INA219_CFG) < 0);
+	CHECK(e->count[INA219_ERR_NACK] == 1);
+
+	CHECK(ina219_read_all(1, &raw) < 0);
+	CHECK(e->count[INA219_ERR_NACK] == 2);
+
+	async_done_num = 0;
+	CHECK(!ina219_read_async(1, &raw, async_done));
+	host_run(1000);
+	CHECK(async_done_num == 1 && async_res == -2);
+	CHECK(e->count[INA219_ERR_NACK] == 3);
+	sim_config(0x41, "present=1");
+
+	/* An aborted transfer */
+	CHECK(!ina219_read_async(1, &raw, async_done));
+	twi_asyncAbort();
+	CHECK(async_done_num == 2 && async_res == -ETIMEDOUT);
+	CHECK(e->count[INA219_ERR_OTHER] == 1);
+	CHECK(e->last_code == -ETIMEDOUT);
+
+	sim_config(0x41, "short=1");
+	CHECK(!ina219_read_async(1, &raw, async_done));
+	host_run(1000);
+	CHECK(async_done_num == 3 && async_res == -EIO);
+	CHECK(e->count[INA219_ERR_SHORT] == 1);
+	CHECK(ina219_read(1, INA219_CFG) < 0);
+	CHECK(e->count[INA219_ERR_SHORT] == 2);
+	sim_config(0x41, "short=0");
+
+	sim_config(0x41, "ovf=1");
+	CHECK(!ina219_read_async(1, &raw, async_done));
+	host_run(1000);
+	CHECK(async_done_num == 4 && !async_res);
+	CHECK(e->count[INA219_ERR_OVF] == 1);
+	sim_config(0x41, "ovf=0");
+
+	CHECK(ina219_error_total(e) == 7);
+	CHECK(ina219_error_total(&ina219_errors[0]) == 0);
+}
+
+/* Errors are only reported when that cannot corrupt other output */
+static void test_report(void)
+{
+	ina219_error(0, INA219_ERR_OTHER, -ETIMEDOUT);
+
+	cmd_mode = CMD_BUSY;
+	host_output_clear();
+	host_run(2 * INA219_REPORT_PERIOD);
+	CHECK(!strstr(host_output, "INA219-0"));
+
+	cmd_mode = CMD_COMMAND;
+	host_run(INA219_REPORT_PERIOD);
+	CHECK(strstr(host_output, "INA219-0: 1 new errors"));
+}
+
+int main(void)
+{
+	test_probe();
+	test_configure();
+	test_read_all();
+	test_read_async();
+	test_errors();
+	test_report();
+	puts("ina219_test: ok");
+	return 0;
+}
@@ -0,0 +1,45 @@
+//
+// Host Replacement for the Teensy Core, as used by yield()
+//
+// © Copyright 2026 Glider bv
+//
+// This file is subject to the terms and conditions of the GNU General Public
+// License, version 2.
+//
+
+#include <stdint.h>
+
+#define __disable_irq()		do { } while (0)
+#define __enable_irq()		do { } while (0)
+
+struct usb_serial_port {
+	uint8_t cdc_rx_endpoint;
+};
+
+extern "C" struct usb_serial_port usb_serial_ports[];
+extern "C" volatile uint32_t usb_rx_pending;
+
+/*
+ * A serial port with a receive buffer filled by the test, counting calls to
+ * available().  Like the USB serial ports, available() calls yield() when
+ * nothing was received.
+ */
+class HostSerial {
+public:
+	HostSerial(int usb) : usb(usb), count(0), polls(0) { }
+	int available(void);
+
+	const int usb;
+	unsigned int count;	// Bytes received, not read yet
+	unsigned int polls;
+};
+
+extern HostSerial Serial, SerialUSB1, SerialUSB2;
+extern HostSerial Serial1, Serial2, Serial3;
+
+extern void serialEvent(void);
+extern void serialEventUSB1(void);
+extern void serialEventUSB2(void);
+extern void serialEvent1(void);
+extern void serialEvent2(void);
+extern void serialEvent3(void);
@@ -0,0 +1,13 @@
+//
+// Host Replacement for the Teensy Event Responder
+//
+// © Copyright 2026 Glider bv
+//
+// This file is subject to the terms and conditions of the GNU General Public
+// License, version 2.
+//
+
+class EventResponder {
+public:
+	static void runFromYield(void) { }
+};
@@ -0,0 +1,62 @@
+//
+// Host Replacement for the Teensy Core
+//
+// © Copyright 2026 Glider bv
+//
+// This file is subject to the terms and conditions of the GNU General Public
+// License, version 2.
+//
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define F_CPU			72000000
+#define F_BUS			36000000
+
+#define INPUT			0
+#define OUTPUT			1
+
+/*
+ * Time only advances when a test says so, through host_us or delay*().
+ * The cycle counter follows it.
+ */
+extern uint32_t host_us;
+
+extern uint32_t micros(void);
+extern uint32_t millis(void);
+extern void delay(uint32_t ms);
+extern void delayMicroseconds(uint32_t us);
+extern void yield(void);
+
+extern void pinMode(uint8_t pin, uint8_t mode);
+extern void digitalWrite(uint8_t pin, uint8_t val);
+
+extern volatile uint32_t usb_rx_pending;
+extern int serial_available(void);
+extern int serial2_available(void);
+
+#define __disable_irq()		do { } while (0)
+#define __enable_irq()		do { } while (0)
+#define NVIC_ENABLE_IRQ(n)	do { } while (0)
+
+/* Peripheral registers, backed by host memory */
+extern volatile uint32_t host_regs[16];
+
+#define ARM_DEMCR		host_regs[0]
+#define ARM_DEMCR_TRCENA	(1 << 24)
+#define ARM_DWT_CTRL		host_regs[1]
+#define ARM_DWT_CTRL_CYCCNTENA	(1 << 0)
+#define ARM_DWT_CYCCNT		(host_us * (F_CPU / 1000000))
+
+#define SIM_SCGC6		host_regs[3]
+#define SIM_SCGC6_PIT		(1 << 23)
+#define PIT_MCR			host_regs[4]
+#define PIT_LDVAL3		host_regs[5]
+#define PIT_TCTRL3		host_regs[6]
+#define PIT_TFLG3		host_regs[7]
+#define PIT_TCTRL_TIE		(1 << 1)
+#define PIT_TCTRL_TEN		(1 << 0)
+#define PIT_TFLG_TIF		(1 << 0)
+#define IRQ_PIT_CH3		33
@@ -0,0 +1,12 @@
+//
+// Host Replacement for the USB Serial Port
+//
+// © Copyright 2026 Glider bv
+//
+// This file is subject to the terms and conditions of the GNU General Public
+// License, version 2.
+//
+
+extern int usb_serial_putchar(uint8_t c);
+extern int usb_serial_write(const void *buffer, uint32_t size);
+extern int usb_serial_write_buffer_free(void);
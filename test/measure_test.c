@@ -0,0 +1,171 @@
+//
+// Power Monitor Tests, against the INA219 Simulator
+//
+// © Copyright 2026 Glider bv
+//
+// This file is subject to the terms and conditions of the GNU General Public
+// License, version 2.
+//
+
+#include <stdio.h>
+#include <string.h>
+#include <twi.h>
+#include <WProgram.h>
+
+#include "acquire.h"
+#include "cmd.h"
+#include "env.h"
+#include "host.h"
+#include "ina219.h"
+#include "ina219sim.h"
+#include "measure.h"
+#include "stream.h"
+#include "task.h"
+#include "util.h"
+
+static void sim_config(int addr, const char *params)
+{
+	char buf[64], *argv[] = { buf };
+
+	snprintf(buf, sizeof(buf), "%s", params);
+	CHECK(!ina219_sim_config(addr, 1, argv));
+}
+
+static unsigned int count(const char *s, const char *sub)
+{
+	unsigned int n = 0;
+
+	while ((s = strstr(s, sub))) {
+		n++;
+		s++;
+	}
+	return n;
+}
+
+/* Reverse current is only reported when it cannot corrupt other output */
+static void test_reverse(void)
+{
+	static const int quiet[] = { CMD_STREAM, CMD_BUSY, CMD_TEST };
+	unsigned int i;
+
+	host_output_clear();
+	host_run(2 * HZ);
+	CHECK(!strstr(host_output, "Reverse"));
+
+	sim_config(0x40, "ilo=-50");
+	for (i = 0; i < ARRAY_SIZE(quiet); i++) {
+		cmd_mode = quiet[i];
+		host_output_clear();
+		host_run(2 * HZ);
+		CHECK(!strstr(host_output, "Reverse"));
+	}
+
+	cmd_mode = CMD_COMMAND;
+	host_run(2 * HZ);
+	CHECK(count(host_output, "Reverse current on power channel A: -49") == 1);
+
+	/* A new event, while the previous one wasn't reported yet */
+	cmd_mode = CMD_BUSY;
+	sim_config(0x40, "ilo=100");
+	host_run(HZ);
+	sim_config(0x40, "ilo=-70");
+	host_run(HZ);
+	sim_config(0x40, "ilo=100");
+	host_run(HZ);
+	host_output_clear();
+	cmd_mode = CMD_MONITOR;
+	host_run(HZ);
+	CHECK(count(host_output, "Reverse current on power channel A: -69") == 1);
+	cmd_mode = CMD_COMMAND;
+}
+
+/*
+ * A stream starts with its header, and samples the host doesn't accept are
+ * dropped and counted
+ */
+static void test_stream(void)
+{
+	unsigned int queued, dropped;
+
+	host_output_clear();
+	cmd_mode = CMD_STREAM;
+	stream_start(1);
+	host_run(HZ);
+	CHECK(!memcmp(host_output, "BFFS", 4));
+
+	/* The host output is full by now */
+	host_run(HZ);
+	cmd_mode = CMD_COMMAND;
+	host_output_clear();
+	stream_show_stats();
+	CHECK(sscanf(host_output, "Stream: %u samples, %u dropped", &queued,
+		     &dropped) == 2);
+	CHECK(queued && dropped);
+
+	stream_reset_stats();
+	host_output_clear();
+	stream_show_stats();
+	CHECK(!strcmp(host_output, "Stream: 0 samples, 0 dropped\n"));
+}
+
+static unsigned int acquire_period(unsigned int *overruns)
+{
+	unsigned int period;
+
+	host_output_clear();
+	acquire_show_stats();
+	CHECK(sscanf(strstr(host_output, "Period"),
+		     "Period %u us, %u overruns", &period, overruns) == 2);
+	return period;
+}
+
+/* The bus keeps up with the shortest acquisition period, at any frequency */
+static void test_period(void)
+{
+	unsigned int slow, fast, overruns;
+
+	acquire_set_period(0);
+	acquire_reset_stats();
+	host_run(HZ);
+	slow = acquire_period(&overruns);
+	/* 3 channels, 98 bits each at 100 kHz */
+	CHECK(slow >= 3 * 980);
+	CHECK(!overruns);
+
+	twi_setFrequency(400000);
+	acquire_set_period(0);
+	host_run(HZ / 10);
+	acquire_reset_stats();
+	host_run(HZ);
+	fast = acquire_period(&overruns);
+	CHECK(fast >= 3 * 245 && fast < slow / 2);
+	CHECK(!overruns);
+}
+
+/* A malformed setting is not applied partially */
+static void test_init(void)
+{
+	struct ina219_params params;
+
+	env_set("ina219C", "shunt=50,imax=oops");
+	host_output_clear();
+	measure_init();
+	CHECK(strstr(host_output, "Invalid INA219 parameters"));
+	CHECK(strstr(host_output, "Using defaults for INA219-2"));
+	ina219_get_params(2, &params);
+	CHECK(params.shunt_mohm == ina219_default_params.shunt_mohm);
+}
+
+int main(void)
+{
+	twi_init();
+	test_init();
+	/* The acquisition enables the cycle counter it timestamps from */
+	CHECK(ARM_DEMCR & ARM_DEMCR_TRCENA);
+	CHECK(ARM_DWT_CTRL & ARM_DWT_CTRL_CYCCNTENA);
+	test_reverse();
+	test_stream();
+	test_period();
+	puts("measure_test: ok");
+	return 0;
+}
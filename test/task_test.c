@@ -0,0 +1,319 @@
+//
+// Task Management Tests
+//
+// © Copyright 2026 Glider bv
+//
+// This file is subject to the terms and conditions of the GNU General Public
+// License, version 2.
+//
+
+#include <stdio.h>
+
+#include "host.h"
+
+/* Include the implementation, to get at the task heaps */
+#include "../src/task.c"
+
+#define TEST_ROUNDS		2000
+#define TEST_OPS		200
+
+static int task_nop(void)
+{
+	return 0;
+}
+
+static unsigned int tasks_queued(void)
+{
+	unsigned int n = 0;
+	int prio;
+
+	for (prio = 0; prio < TASK_PRIO_NUM; prio++)
+		n += heaps[prio].num;
+	return n;
+}
+
+/* Every task is in the heap of its priority level, and no child is due first */
+static void check_heaps(void)
+{
+	const struct task_heap *heap;
+	unsigned int i;
+	int prio;
+
+	for (prio = 0; prio < TASK_PRIO_NUM; prio++) {
+		heap = &heaps[prio];
+		for (i = 0; i < heap->num; i++) {
+			CHECK(heap->tasks[i]->slot == i);
+			CHECK(heap->tasks[i]->prio == prio);
+			if (i)
+				CHECK(!task_before(heap->tasks[i],
+						   heap->tasks[(i - 1) / 2]));
+		}
+	}
+}
+
+static void clear_heaps(void)
+{
+	int prio;
+
+	for (prio = 0; prio < TASK_PRIO_NUM; prio++)
+		while (heaps[prio].num)
+			task_del(heaps[prio].tasks[0]);
+}
+
+/* Run the next task, advancing time to its deadline if needed */
+static struct task *run_next(void)
+{
+	struct task *task;
+	int32_t delta;
+
+	task = task_next(&delta);
+	if (!task)
+		return NULL;
+
+	if (delta > 0) {
+		host_us += delta;
+		task = task_next(&delta);
+	}
+	task_run(task, -delta);
+	return task;
+}
+
+/*
+ * Random adds, deletes and runs, with a clock that wraps around during each
+ * round.
+ */
+static void test_random(void)
+{
+	static struct task tasks[TASK_MAX];
+	struct task *task;
+	unsigned int i, j;
+
+	srand(1);
+	for (i = 0; i < TEST_ROUNDS; i++) {
+		host_us = 0xfff00000 + rand() % 0x100000;
+		for (j = 0; j < TASK_MAX; j++) {
+			task = &tasks[j];
+			task->name = "random";
+			task->func = task_nop;
+			task->prio = rand() % TASK_PRIO_NUM;
+			task->policy = rand() % 3;
+			task->period = rand() % 5000000;
+			task_add(task);
+		}
+		CHECK(tasks_queued() == TASK_MAX);
+		check_heaps();
+
+		for (j = 0; j < TEST_OPS; j++) {
+			task = &tasks[rand() % TASK_MAX];
+			task_del(task);
+			CHECK(!task_queued(task));
+			if (rand() & 1) {
+				task->period = rand() % 5000000;
+				task_add(task);
+				CHECK(task_queued(task));
+			}
+			check_heaps();
+
+			run_next();
+			check_heaps();
+		}
+		clear_heaps();
+	}
+}
+
+static unsigned int order[TASK_MAX], order_num;
+
+#define DEFINE_ORDER_TASK(n)						\
+	static int task_order##n(void)					\
+	{								\
+		order[order_num++] = n;					\
+		return TASK_DONE;					\
+	}
+
+DEFINE_ORDER_TASK(0)
+DEFINE_ORDER_TASK(1)
+DEFINE_ORDER_TASK(2)
+DEFINE_ORDER_TASK(3)
+
+/* Deadlines on both sides of the micros() wraparound run in order */
+static void test_wraparound(void)
+{
+	static int (*funcs[])(void) = {
+		task_order0, task_order1, task_order2, task_order3,
+	};
+	/* Periods in run order, deadlines from 0xffffff00 to 0x200 */
+	static const unsigned int periods[] = { 0x100, 0x180, 0x280, 0x400 };
+	static struct task tasks[ARRAY_SIZE(funcs)];
+	unsigned int i;
+
+	host_us = 0xfffffe00;
+	order_num = 0;
+	for (i = ARRAY_SIZE(tasks); i-- > 0; ) {
+		tasks[i].name = "wrap";
+		tasks[i].func = funcs[i];
+		tasks[i].period = periods[i];
+		task_add(&tasks[i]);
+		/* task_add() makes a new task due immediately */
+		tasks[i].base = host_us;
+		task_sift_down(task_heap(&tasks[i]), tasks[i].slot);
+	}
+	check_heaps();
+
+	while (run_next())
+		check_heaps();
+
+	CHECK(order_num == ARRAY_SIZE(tasks));
+	for (i = 0; i < order_num; i++)
+		CHECK(order[i] == i);
+	CHECK(host_us == 0x200);
+}
+
+static unsigned int prio_runs[TASK_PRIO_NUM];
+static uint32_t busy_us;
+
+static int task_low(void)
+{
+	prio_runs[TASK_PRIO_LOW]++;
+	return 0;
+}
+
+/* Keeps the CPU busy for busy_us */
+static int task_high(void)
+{
+	prio_runs[TASK_PRIO_HIGH]++;
+	host_us += busy_us;
+	return 0;
+}
+
+/* A ready high priority task runs first, even if its deadline is later */
+static void test_priority(void)
+{
+	struct task low = {
+		.name = "low", .func = task_low, .period = 1000,
+		.prio = TASK_PRIO_LOW,
+	};
+	struct task high = {
+		.name = "high", .func = task_high, .period = 1000,
+		.prio = TASK_PRIO_HIGH,
+	};
+	struct task *task;
+	int32_t delta;
+
+	host_us = 0;
+	busy_us = 0;
+	task_add(&low);
+	task_add(&high);
+	low.base -= 500;
+	task_sift_up(task_heap(&low), low.slot);
+
+	task = task_next(&delta);
+	CHECK(task == &high && delta == 0);
+
+	/* Not ready yet, so the nearest deadline wins */
+	task_run(task, 0);
+	task = task_next(&delta);
+	CHECK(task == &low && delta == -500);
+	task_run(task, 500);
+	task = task_next(&delta);
+	CHECK(task == &low && delta == 500);
+
+	host_us += 1000;
+	task = task_next(&delta);
+	CHECK(task == &high && delta == 0);
+
+	clear_heaps();
+}
+
+/*
+ * Low priority tasks starve for as long as high priority tasks keep the CPU
+ * busy, and catch up once there is time left.
+ */
+static void test_starvation(void)
+{
+	struct task low = {
+		.name = "low", .func = task_low, .period = 10000,
+		.policy = TASK_SKIP_MISSED, .prio = TASK_PRIO_LOW,
+	};
+	struct task high = {
+		.name = "high", .func = task_high, .period = 1000,
+		.policy = TASK_CATCH_UP, .prio = TASK_PRIO_HIGH,
+	};
+	unsigned int i;
+
+	host_us = 0xfff00000;
+	memset(prio_runs, 0, sizeof(prio_runs));
+	task_add(&high);
+	task_add(&low);
+
+	/* Fully loaded */
+	busy_us = 1000;
+	for (i = 0; i < 1000; i++)
+		run_next();
+	CHECK(prio_runs[TASK_PRIO_HIGH] == 1000);
+	CHECK(prio_runs[TASK_PRIO_LOW] == 0);
+
+	/* Half loaded, the low priority task runs at its nominal rate */
+	busy_us = 500;
+	memset(prio_runs, 0, sizeof(prio_runs));
+	while (prio_runs[TASK_PRIO_HIGH] < 1000)
+		run_next();
+	CHECK(prio_runs[TASK_PRIO_LOW] >= 100);
+	CHECK(prio_runs[TASK_PRIO_LOW] <= 101);
+	CHECK(low.late <= busy_us);
+	CHECK(low.skipped >= 99);
+
+	clear_heaps();
+}
+
+static unsigned long fired[TIMER_MAX];
+static unsigned int fired_num;
+
+static void timer_fire(unsigned long data)
+{
+	fired[fired_num++] = data;
+}
+
+static void test_timers(void)
+{
+	int handles[TIMER_MAX];
+	unsigned int i;
+	int handle;
+
+	host_us = 0xffffff00;
+	fired_num = 0;
+	for (i = 0; i < TIMER_MAX; i++) {
+		handles[i] = task_timer_add(timer_fire, i, 1000 * (TIMER_MAX - i));
+		CHECK(handles[i] > 0);
+	}
+	CHECK(task_timer_add(timer_fire, TIMER_MAX, 5) < 0);
+
+	CHECK(task_timer_cancel(handles[3]) == 0);
+	CHECK(task_timer_cancel(handles[3]) < 0);
+	CHECK(task_timer_cancel(0) < 0);
+
+	while (run_next())
+		check_heaps();
+
+	/* Timers with shorter delays fire first */
+	CHECK(fired_num == TIMER_MAX - 1);
+	for (i = 1; i < fired_num; i++)
+		CHECK(fired[i] < fired[i - 1]);
+
+	/* Stale handles are ignored, also after their timer is reused */
+	CHECK(task_timer_cancel(handles[5]) < 0);
+	handle = task_timer_add(timer_fire, 0, 10);
+	CHECK(handle > 0 && handle != handles[TIMER_MAX - 1]);
+	CHECK(task_timer_cancel(handles[TIMER_MAX - 1]) < 0);
+	CHECK(task_timer_cancel(handle) == 0);
+}
+
+int main(void)
+{
+	test_random();
+	test_wraparound();
+	test_priority();
+	test_starvation();
+	test_timers();
+	puts("task_test: ok");
+	return 0;
+}
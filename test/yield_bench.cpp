@@ -0,0 +1,156 @@
+//
+// yield() Benchmark, Polling vs. Pending-Event Dispatch
+//
+// © Copyright 2026 Glider bv
+//
+// This file is subject to the terms and conditions of the GNU General Public
+// License, version 2.
+//
+
+#include <stdio.h>
+#include <time.h>
+
+#include <Arduino.h>
+#include "EventResponder.h"
+
+extern "C" {
+#include "host.h"
+#include "util.h"
+}
+
+/*
+ * Runs the serial event dispatcher of yield() in teensy3/yield.cpp against
+ * the polling dispatcher it replaced, on a mostly idle console, like the
+ * run loop sees it, and fails if the former polls more ports than the
+ * latter, or loses input.  The times are host times, use the "tasks"
+ * command for cycles on the target.
+ */
+#define BENCH_CALLS		1000000
+#define BENCH_RX_INTERVAL	1000	/* yield() calls per received packet */
+#define BENCH_RX_BYTES		100	/* More than a handler reads per call */
+#define BENCH_EVENT_BYTES	64	/* Read by an event handler per call */
+
+/* The USB serial receive endpoints of USB_TRIPLE_SERIAL */
+struct usb_serial_port usb_serial_ports[] = { { 3 }, { 6 }, { 9 } };
+
+HostSerial Serial(1), SerialUSB1(1), SerialUSB2(1);
+HostSerial Serial1(0), Serial2(0), Serial3(0);
+
+static HostSerial *const usb_ports[] = { &Serial, &SerialUSB1, &SerialUSB2 };
+static HostSerial *const ports[] = {
+	&Serial, &SerialUSB1, &SerialUSB2, &Serial1, &Serial2, &Serial3
+};
+
+/* The dispatcher being benchmarked, also called by available() */
+static void (*bench_yield)(void);
+static unsigned int bench_bytes;
+
+void yield(void);
+
+/* yield() before the pending-event bitmask, as built for the BCU/2 */
+static void yield_polling(void)
+{
+	static uint8_t running = 0;
+
+	if (running) return;
+	running = 1;
+	if (Serial.available()) serialEvent();
+	if (SerialUSB1.available()) serialEventUSB1();
+	if (SerialUSB2.available()) serialEventUSB2();
+	if (Serial1.available()) serialEvent1();
+	if (Serial2.available()) serialEvent2();
+	if (Serial3.available()) serialEvent3();
+	running = 0;
+	EventResponder::runFromYield();
+}
+
+int HostSerial::available(void)
+{
+	polls++;
+	if (!count && usb)
+		bench_yield();
+	return count;
+}
+
+static void bench_read(HostSerial *port)
+{
+	unsigned int n = port->count < BENCH_EVENT_BYTES ? port->count
+							 : BENCH_EVENT_BYTES;
+
+	port->count -= n;
+	bench_bytes += n;
+}
+
+void serialEvent(void) { bench_read(&Serial); }
+void serialEventUSB1(void) { bench_read(&SerialUSB1); }
+void serialEventUSB2(void) { bench_read(&SerialUSB2); }
+void serialEvent1(void) { bench_read(&Serial1); }
+void serialEvent2(void) { bench_read(&Serial2); }
+void serialEvent3(void) { bench_read(&Serial3); }
+
+/* Receive a packet on a USB serial port, like usb_isr() does */
+static void bench_receive(unsigned int i)
+{
+	usb_ports[i]->count += BENCH_RX_BYTES;
+	usb_rx_pending |= 1UL << (usb_serial_ports[i].cdc_rx_endpoint - 1);
+}
+
+static uint64_t bench_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Returns the number of available() calls */
+static unsigned int bench_run(const char *name, void (*dispatch)(void))
+{
+	unsigned int i, polls = 0, received = 0;
+	uint64_t ns;
+
+	for (i = 0; i < ARRAY_SIZE(ports); i++)
+		ports[i]->polls = 0;
+	usb_rx_pending = 0;
+	bench_yield = dispatch;
+	bench_bytes = 0;
+
+	ns = bench_ns();
+	for (i = 0; i < BENCH_CALLS; i++) {
+		if (!(i % BENCH_RX_INTERVAL)) {
+			bench_receive(i / BENCH_RX_INTERVAL %
+				      ARRAY_SIZE(usb_ports));
+			received += BENCH_RX_BYTES;
+		}
+		dispatch();
+	}
+	ns = bench_ns() - ns;
+
+	for (i = 0; i < ARRAY_SIZE(ports); i++)
+		polls += ports[i]->polls;
+	printf("%-8s  %7.1f  %10.2f\n", name, (double)ns / BENCH_CALLS,
+	       (double)polls / BENCH_CALLS);
+
+	/* All input was handled, and none is left behind */
+	CHECK(bench_bytes == received);
+	return polls;
+}
+
+int main(void)
+{
+	unsigned int polling, pending;
+
+	printf("%u calls, a %u byte packet every %u calls\n", BENCH_CALLS,
+	       BENCH_RX_BYTES, BENCH_RX_INTERVAL);
+	printf("yield()   ns/call  polls/call\n");
+	polling = bench_run("Polling", yield_polling);
+	pending = bench_run("Pending", yield);
+
+	if (pending >= polling / 2) {
+		fprintf(stderr, "yield_bench: regression, expected less than half the polls of the polling dispatcher\n");
+		return 1;
+	}
+
+	puts("yield_bench: ok");
+	return 0;
+}